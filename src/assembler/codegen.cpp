@@ -1,10 +1,12 @@
 #include "codegen.hpp"
 #include "parser.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <unordered_map>
 
-std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine>> &statements, AssemblyOptions opts){
+std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine>> &statements, AssemblyOptions opts,
+                                  DebugInfo *debug){
   std::vector<CodeRegion> placedRegions;
   std::vector<CodeRegion> unplacedRegions;
 
@@ -80,12 +82,14 @@ std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine
     else if(st.type == Statement::statementType::DATA_IMPERATIVE){
       const DataImperative &imp = st.data.imp;
       current.code.push_back(st);
+      current.lines.push_back(line.lineNum);
       current.nBytes += imp.nBytes;
       addressCounter += imp.nBytes;
     }
     else{
 
       current.code.push_back(st);
+      current.lines.push_back(line.lineNum);
       current.nBytes += 4;
       addressCounter += 4;
     }
@@ -187,6 +191,10 @@ std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine
     }
 
     labelMap[label] = region.startingAddress.value();
+
+    if(debug){
+      debug->symbols.push_back(Symbol{label, region.startingAddress.value(), region.nBytes});
+    }
   }
 
 
@@ -200,7 +208,9 @@ std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine
     ret.insert(ret.end(), region.startingAddress.value() - addressCounter, 0);
 
     // TODO: This whole codegen should really be in a class or at least shared structures, this is terrible
-    for(const auto &statement : region.code){
+    for(size_t i{0}; i < region.code.size(); i++){
+      const Statement &statement = region.code[i];
+
       if(statement.type == Statement::statementType::DATA_IMPERATIVE){
         const DataImperative &imp = statement.data.imp;
         if(imp.label){ // We know from parsing that nBytes already must be 4
@@ -220,6 +230,11 @@ std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine
       }
       else if(statement.type == Statement::statementType::INSTRUCTION){
         const Instruction &inst = statement.data.inst;
+
+        if(debug){
+          debug->lines.push_back(SourceLine{static_cast<uint32_t>(ret.size()), region.lines[i]});
+        }
+
         ret.push_back(inst.opcode);
         uint8_t regs = inst.r0 << 4;
         regs |= inst.r1;
@@ -4,6 +4,7 @@
 #include "tokenizer.hpp"
 #include <vector>
 #include <cstdint>
+#include <string>
 #include <string_view>
 #include <optional>
 #include <utility>
@@ -15,6 +16,7 @@ struct CodeRegion {
   std::optional<uint32_t> startingAddress{};
   uint32_t nBytes{};
   std::vector<Statement> code{};
+  std::vector<uint32_t> lines{}; // Source line of each statement in code
 
   CodeRegion(std::string_view label) : label{label} {};
   CodeRegion() = default;
@@ -24,5 +26,26 @@ struct AssemblyOptions {
   bool packingEnabled{false};
 };
 
-std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine>> &statements, AssemblyOptions opts);
+// Placement of a labelled region in the image
+struct Symbol {
+  std::string name;
+  uint32_t address;
+  uint32_t nBytes;
+};
+
+// Source line of the instruction at address
+struct SourceLine {
+  uint32_t address;
+  uint32_t line;
+};
+
+// Where labels and instructions ended up, both in address order
+struct DebugInfo {
+  std::vector<Symbol> symbols{};
+  std::vector<SourceLine> lines{};
+};
+
+// Fills debug if given
+std::vector<uint8_t> generateCode(std::vector<std::pair<Statement, tokenizedLine>> &statements, AssemblyOptions opts,
+                                  DebugInfo *debug = nullptr);
 std::vector<uint8_t> littleEndian(uint64_t val, uint8_t nBytes);
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include "codegen.hpp"
 #include "parser.hpp"
 #include "tokenizer.hpp"
+#include "src/common/debugmap.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <ios>
 #include <iostream>
 #include <stdexcept>
@@ -13,6 +17,45 @@
 #include <fstream>
 
 
+// Layout is described in debugmap.hpp
+static bool writeDebugMap(const std::filesystem::path &path, const DebugInfo &debug, const std::string &source){
+  std::string strings{source};
+  std::vector<DebugMapSymbol> symbols{};
+  std::vector<DebugMapLine> lines{};
+
+  // Packing may have placed regions out of label order
+  std::vector<Symbol> sorted{debug.symbols};
+  std::sort(sorted.begin(), sorted.end(), [](const Symbol &a, const Symbol &b){
+    return a.address < b.address;
+  });
+
+  for(const Symbol &symbol : sorted){
+    symbols.push_back(DebugMapSymbol{symbol.address, symbol.nBytes, static_cast<uint32_t>(strings.size()),
+                                     static_cast<uint32_t>(symbol.name.size())});
+    strings += symbol.name;
+  }
+
+  for(const SourceLine &line : debug.lines){
+    lines.push_back(DebugMapLine{line.address, line.line});
+  }
+
+  DebugMapHeader header{};
+  std::memcpy(header.magic, DEBUG_MAP_MAGIC, sizeof(header.magic));
+  header.symbolCount = symbols.size();
+  header.lineCount = lines.size();
+  header.stringBytes = strings.size();
+  header.sourceName = 0;
+  header.sourceNameLength = source.size();
+
+  std::ofstream file(path, std::ios::binary | std::ios::out);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(symbols.data()), symbols.size() * sizeof(DebugMapSymbol));
+  file.write(reinterpret_cast<const char *>(lines.data()), lines.size() * sizeof(DebugMapLine));
+  file.write(strings.data(), strings.size());
+
+  return static_cast<bool>(file);
+}
+
 int main(int argc, char *argv[]){
   // Could change to use a hash table with more arguments
   // Linear is fine for now
@@ -23,10 +66,12 @@ int main(int argc, char *argv[]){
   const std::string help = "Flags:\n"
                            "-o [filepath]: Set output filepath\n"
                            "-s [imagesize]: Set the output image size in bytes.\n"
+                           "-m [filepath]: Also write a debug map of labels and source lines for the emulator\n"
                            "--pack: Enable code packing (code segments may be reordered)";
 
   std::vector<std::string> positionalArguments{};
   std::filesystem::path outputPath{};
+  std::optional<std::filesystem::path> mapPath{};
   std::optional<std::size_t> imageSize{};
 
   AssemblyOptions assemblyOptions{};
@@ -48,6 +93,13 @@ int main(int argc, char *argv[]){
         return EXIT_FAILURE;
       }
     }
+    else if(arg == "-m"){
+      if(!hasNext){
+        std::cerr << usage << "-m: No map filepath provided\n";
+        return EXIT_FAILURE;
+      }
+      mapPath = argv[++i];
+    }
     else if(arg == "-s"){
       if(!hasNext){
         std::cerr << usage << "-s: No image size provided\n";
@@ -123,7 +175,8 @@ int main(int argc, char *argv[]){
   // open as this function can terminate
   std::vector<tokenizedLine> tokens = tokenize(buffer);
   auto statements = parse(tokens);
-  auto bitStream = generateCode(statements, assemblyOptions);
+  DebugInfo debugInfo{};
+  auto bitStream = generateCode(statements, assemblyOptions, &debugInfo);
 
   #ifdef TOKEN_DEBUG
   for(auto &vt : tokens){
@@ -147,6 +200,11 @@ int main(int argc, char *argv[]){
     return EXIT_FAILURE;
   }
 
+  if(mapPath && !writeDebugMap(mapPath.value(), debugInfo, inputPath.filename().string())){
+    std::cerr << "Error writing to file " + mapPath.value().filename().string() << "\n";
+    return EXIT_FAILURE;
+  }
+
   std::cout << "Done! Output to " << outputPath.filename().string() << "\n";
   
   return EXIT_SUCCESS;
@@ -126,13 +126,40 @@ std::optional<Statement> parseInstruction(Parser &p){
 
   ret.opcode = instAttributes.first;
   
-  if(instAttributes.second == 2){
+  if(instAttributes.second == 3){ // Three registers, the last one is stored in the offset
+    std::optional<uint8_t> regs[3];
+
+    for(int i{0}; i < 3; i++){
+      if(i && !p.get(DELIMITER)){
+        p.error.emplace("Expected \",\"", p.peek());
+        return std::nullopt;
+      }
+
+      regs[i] = parseGPReg(p);
+      if(!regs[i])
+        return std::nullopt;
+    }
+
+    ret.r0 = regs[0].value();
+    ret.r1 = regs[1].value();
+    ret.offset.offset = regs[2].value();
+    return Statement(ret);
+  }
+  else if(instAttributes.second == 2){
+    // Vector ops name V registers, except for the address of VLD and VST and
+    // the scalar side of VBRD and VGET
+    const uint8_t op = ret.opcode & OPCODE_MASK;
+    const bool vectorOp = op >= Op::VLD && op <= Op::VGET;
+    const bool vectorR1 = vectorOp && op != Op::VLD && op != Op::VST && op != Op::VBRD;
+
     std::optional<uint8_t> r0;
 
-    if(ret.opcode != Op::PMOV)
-      r0 = parseGPReg(p);
-    else
+    if(ret.opcode == Op::PMOV)
       r0 = parseProtectedReg(p);
+    else if(vectorOp && op != Op::VGET)
+      r0 = parseVectorReg(p);
+    else
+      r0 = parseGPReg(p);
 
     if(!r0)
       return std::nullopt;
@@ -146,8 +173,16 @@ std::optional<Statement> parseInstruction(Parser &p){
       return std::nullopt;
     }
 
-    auto r1 = parseGPReg(p);
-    
+    // PRD reads a protected register
+    std::optional<uint8_t> r1;
+
+    if(ret.opcode == Op::PRD)
+      r1 = parseProtectedReg(p);
+    else if(vectorR1)
+      r1 = parseVectorReg(p);
+    else
+      r1 = parseGPReg(p);
+
 
     if(!r1)
       return std::nullopt;
@@ -231,9 +266,28 @@ std::optional<uint8_t> parseProtectedReg(Parser &p){
   }
 }
 
+std::optional<uint8_t> parseVectorReg(Parser &p){
+  auto id = p.get(IDENTIFIER);
+
+  if(!id){
+    p.error.emplace("Expected a register argument", p.peek());
+    return std::nullopt;
+  }
+
+  std::string name = std::string(id->contents);
+
+  if(vectorRegNames.contains(name))
+    return vectorRegNames[name];
+  else{
+    p.error.emplace("Expected a vector register, got unknown identifier \"" + name + "\"",
+                    id.value());
+    return std::nullopt;
+  }
+}
+
 // TODO: This function is messy, fix would be nice
 std::optional<Offset> parseOffset(Parser &p){
-  Offset ret;
+  Offset ret{};
 
   auto sign = p.getAny({PLUS, MINUS});
 
@@ -355,7 +409,8 @@ std::optional<Statement> parseDataImperative(Parser &p){
 
   std::string i = std::string(ident->contents);
 
-  if(instNames.contains(i) || regNames.contains(i) || protectedRegNames.contains(i)){
+  if(instNames.contains(i) || regNames.contains(i) || protectedRegNames.contains(i)
+     || vectorRegNames.contains(i)){
     p.error.emplace("Identifier \"" + i + "\" is a reserved keyword", ident.value());
     return std::nullopt;
   }
@@ -428,7 +483,8 @@ std::optional<Statement> parseLabel(Parser &p){
 
   ret.name = ident->contents;
 
-  if(instNames.contains(i) || regNames.contains(i) || protectedRegNames.contains(i)){
+  if(instNames.contains(i) || regNames.contains(i) || protectedRegNames.contains(i)
+     || vectorRegNames.contains(i)){
     p.error.emplace("Identifier \"" + i + "\" is a reserved keyword", ident.value());
     return std::nullopt;
   }
@@ -107,6 +107,11 @@ struct Parser {
 };
 
 
+// Lanewise vector mnemonics carry their lane width of 8 << width bits
+constexpr Op withLaneWidth(const Op op, const uint8_t width){
+  return static_cast<Op>(op | width << LANE_WIDTH_SHIFT);
+}
+
 // Instruction mnemonic to opcode + number of operands
 static std::unordered_map<std::string, std::pair<Op, uint8_t>> instNames{
   {"MOV", {Op::MOV, 2}},
@@ -144,6 +149,59 @@ static std::unordered_map<std::string, std::pair<Op, uint8_t>> instNames{
   {"INT", {Op::INT, 1}},
   {"PMOV", {Op::PMOV, 2}},
   {"IRET", {Op::IRET, 0}},
+  {"HLT", {Op::HLT, 0}},
+  {"BRK", {Op::BRK, 0}},
+  {"CAS", {Op::CAS, 2}},
+  {"FADD", {Op::FADD, 2}},
+  {"PRD", {Op::PRD, 2}},
+  {"MCPY", {Op::MCPY, 3}},
+  {"MSET", {Op::MSET, 3}},
+  {"VLD", {Op::VLD, 2}},
+  {"VST", {Op::VST, 2}},
+  {"VADD8", {withLaneWidth(Op::VADD, 0), 2}},
+  {"VADD16", {withLaneWidth(Op::VADD, 1), 2}},
+  {"VADD32", {withLaneWidth(Op::VADD, 2), 2}},
+  {"VADD64", {withLaneWidth(Op::VADD, 3), 2}},
+  {"VSUB8", {withLaneWidth(Op::VSUB, 0), 2}},
+  {"VSUB16", {withLaneWidth(Op::VSUB, 1), 2}},
+  {"VSUB32", {withLaneWidth(Op::VSUB, 2), 2}},
+  {"VSUB64", {withLaneWidth(Op::VSUB, 3), 2}},
+  {"VAND8", {withLaneWidth(Op::VAND, 0), 2}},
+  {"VAND16", {withLaneWidth(Op::VAND, 1), 2}},
+  {"VAND32", {withLaneWidth(Op::VAND, 2), 2}},
+  {"VAND64", {withLaneWidth(Op::VAND, 3), 2}},
+  {"VOR8", {withLaneWidth(Op::VOR, 0), 2}},
+  {"VOR16", {withLaneWidth(Op::VOR, 1), 2}},
+  {"VOR32", {withLaneWidth(Op::VOR, 2), 2}},
+  {"VOR64", {withLaneWidth(Op::VOR, 3), 2}},
+  {"VXOR8", {withLaneWidth(Op::VXOR, 0), 2}},
+  {"VXOR16", {withLaneWidth(Op::VXOR, 1), 2}},
+  {"VXOR32", {withLaneWidth(Op::VXOR, 2), 2}},
+  {"VXOR64", {withLaneWidth(Op::VXOR, 3), 2}},
+  {"VSHL8", {withLaneWidth(Op::VSHL, 0), 2}},
+  {"VSHL16", {withLaneWidth(Op::VSHL, 1), 2}},
+  {"VSHL32", {withLaneWidth(Op::VSHL, 2), 2}},
+  {"VSHL64", {withLaneWidth(Op::VSHL, 3), 2}},
+  {"VSHR8", {withLaneWidth(Op::VSHR, 0), 2}},
+  {"VSHR16", {withLaneWidth(Op::VSHR, 1), 2}},
+  {"VSHR32", {withLaneWidth(Op::VSHR, 2), 2}},
+  {"VSHR64", {withLaneWidth(Op::VSHR, 3), 2}},
+  {"VCEQ8", {withLaneWidth(Op::VCEQ, 0), 2}},
+  {"VCEQ16", {withLaneWidth(Op::VCEQ, 1), 2}},
+  {"VCEQ32", {withLaneWidth(Op::VCEQ, 2), 2}},
+  {"VCEQ64", {withLaneWidth(Op::VCEQ, 3), 2}},
+  {"VCGT8", {withLaneWidth(Op::VCGT, 0), 2}},
+  {"VCGT16", {withLaneWidth(Op::VCGT, 1), 2}},
+  {"VCGT32", {withLaneWidth(Op::VCGT, 2), 2}},
+  {"VCGT64", {withLaneWidth(Op::VCGT, 3), 2}},
+  {"VBRD8", {withLaneWidth(Op::VBRD, 0), 2}},
+  {"VBRD16", {withLaneWidth(Op::VBRD, 1), 2}},
+  {"VBRD32", {withLaneWidth(Op::VBRD, 2), 2}},
+  {"VBRD64", {withLaneWidth(Op::VBRD, 3), 2}},
+  {"VGET8", {withLaneWidth(Op::VGET, 0), 2}},
+  {"VGET16", {withLaneWidth(Op::VGET, 1), 2}},
+  {"VGET32", {withLaneWidth(Op::VGET, 2), 2}},
+  {"VGET64", {withLaneWidth(Op::VGET, 3), 2}},
 };
 
 static std::unordered_map<std::string, uint8_t> regNames {
@@ -171,6 +229,30 @@ static std::unordered_map<std::string, uint8_t> protectedRegNames {
   {"PSP", ProtectedReg::PSP},
   {"IJT", ProtectedReg::IJT},
   {"RPT", ProtectedReg::RPT},
+  {"TIMER", ProtectedReg::TIMER},
+  {"RETIRED", ProtectedReg::RETIRED},
+  {"PAGE_FAULTS", ProtectedReg::PAGE_FAULTS},
+  {"TLB_MISSES", ProtectedReg::TLB_MISSES},
+  {"INTERRUPTS", ProtectedReg::INTERRUPTS},
+};
+
+static std::unordered_map<std::string, uint8_t> vectorRegNames {
+  {"V0", 0},
+  {"V1", 1},
+  {"V2", 2},
+  {"V3", 3},
+  {"V4", 4},
+  {"V5", 5},
+  {"V6", 6},
+  {"V7", 7},
+  {"V8", 8},
+  {"V9", 9},
+  {"V10", 10},
+  {"V11", 11},
+  {"V12", 12},
+  {"V13", 13},
+  {"V14", 14},
+  {"V15", 15},
 };
 
 std::vector<std::pair<Statement,tokenizedLine>> parse(std::vector<tokenizedLine> &input);
@@ -184,5 +266,6 @@ std::optional<Statement> parseDataImperative(Parser &p);
 std::optional<Statement> parseLabel(Parser &p);
 std::optional<uint8_t> parseGPReg(Parser &p);
 std::optional<uint8_t> parseProtectedReg(Parser &p);
+std::optional<uint8_t> parseVectorReg(Parser &p);
 std::optional<Offset> parseOffset(Parser &p);
 std::optional<int16_t> parse16BitInt(Parser &p, Token::tokenType t);
\ No newline at end of file
@@ -2,7 +2,6 @@
 #include <cctype>
 #include <cstdlib>
 #include <stdexcept>
-#include <format>
 #include <iostream>
 
 std::vector<tokenizedLine> tokenize(std::string_view input){
@@ -52,7 +51,7 @@ std::vector<Token> tokenizeLine(std::string_view line, size_t lineNum){
     }
 
     if(!isalnum(cur) && std::string("_,-+():#").find(cur) == std::string::npos){
-      errorMessage = std::format("Illegal character \'{}\'", cur);
+      errorMessage = std::string("Illegal character \'") + cur + "\'";
       break;
     }
 
@@ -90,27 +89,21 @@ std::vector<Token> tokenizeLine(std::string_view line, size_t lineNum){
       // Do nothing, can still be a valid identifier
     }
     catch(std::out_of_range &e){
-      errorMessage = std::format("Integer literal too large");
+      errorMessage = "Integer literal too large";
       pos = pos+processed;
       break;
     }
 
 
-    // Process identifier using alphanum and _
+    // Process identifier using alphanum and _, digits can follow the first
+    // character as in V0 or VADD32, a leading one was an int literal above
     processed = 0;
     while(pos+processed < line.size()){
-      if(!std::isalpha(line.at(pos+processed)) && line.at(pos+processed) != '_')
+      if(!std::isalnum(line.at(pos+processed)) && line.at(pos+processed) != '_')
         break;
       processed++;
     }
 
-    // Do not allow a digit directly after an identifier
-    if(pos+processed < line.size() && std::isdigit(line.at(pos+processed))){
-      errorMessage = "Identifier contains a digit";
-      pos = pos+processed;
-      break;
-    }
-
     ret.emplace_back(IDENTIFIER, line.substr(pos, processed));
     pos = pos+processed;
     continue;
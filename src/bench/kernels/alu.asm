@@ -0,0 +1,13 @@
+start():
+MOV A, Z + 1
+MOV B, Z + 3
+loop():
+ADD A, B
+XOR B, A
+SHL A, Z + 1
+SHR B, Z + 2
+MUL C, A
+SUB C, B
+AND D, C
+OR D, Z + 0x55
+JMP Z + loop
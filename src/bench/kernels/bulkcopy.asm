@@ -0,0 +1,12 @@
+start():
+MOV F, Z + 1
+SHL F, Z + 16
+MOV G, F
+SHL G, Z + 1
+copy():
+MOV A, F
+MOV B, G
+MOV C, Z + 0x7FFF
+ADD C, Z + 1
+MCPY B, A, C
+JMP Z + copy
@@ -0,0 +1,50 @@
+start():
+MOV K, Z + 50
+MOV Y, Z + 0
+restart():
+MOV X, Z + program
+next():
+LBU A, X + 0
+ADD X, Z + 1
+SHL A, Z + 2
+LW B, A + table
+JMP B
+opinc():
+ADD Y, Z + 1
+JMP Z + next
+opdbl():
+ADD Y, Y
+JMP Z + next
+opxor():
+XOR Y, Z + 0x5A
+JMP Z + next
+opdec():
+SUB K, Z + 1
+JMP Z + next
+ophalf():
+MOV B, Y
+AND B, Z + 1
+JZR Z + next
+SHR Y, Z + 1
+JMP Z + next
+oploop():
+SUB K, Z + 0
+JGT Z + restart
+MOV K, Z + 50
+JMP Z + restart
+table():
+DW opinc
+DW opdbl
+DW opxor
+DW opdec
+DW ophalf
+DW oploop
+program():
+DB 0
+DB 1
+DB 4
+DB 2
+DB 0
+DB 4
+DB 3
+DB 5
@@ -0,0 +1,17 @@
+start():
+MOV F, Z + 1
+SHL F, Z + 16
+MOV G, F
+SHL G, Z + 1
+copy():
+MOV A, F
+MOV B, G
+MOV C, Z + 4096
+word():
+LD D, A + 0
+SD D, B + 0
+ADD A, Z + 8
+ADD B, Z + 8
+SUB C, Z + 1
+JGT Z + word
+JMP Z + copy
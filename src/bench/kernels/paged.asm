@@ -0,0 +1,28 @@
+start():
+MOV A, Z + 0x2019
+SW A, Z + 0x1000
+MOV B, Z + 0x19
+MOV C, Z + 0x2000
+MOV D, Z + 1024
+fill():
+SW B, C + 0
+ADD B, Z + 0x1000
+ADD C, Z + 4
+SUB D, Z + 1
+JGT Z + fill
+PMOV RPT, Z + 0x1000
+MOV A, Z + 1
+SHL A, Z + 62
+PMOV EFLAGS, A
+sweep():
+MOV A, Z + 0x10
+SHL A, Z + 12
+MOV D, Z + 1008
+page():
+LD E, A + 0x100
+ADD E, Z + 1
+SD E, A + 0x100
+ADD A, Z + 0x1000
+SUB D, Z + 1
+JGT Z + page
+JMP Z + sweep
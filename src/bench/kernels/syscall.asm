@@ -0,0 +1,13 @@
+start():
+MOV A, Z + handler
+SW A, Z + 0x3500
+PMOV IJT, Z + 0x3000
+PMOV PSP, Z + 0x6000
+MOV SP, Z + 0x7000
+storm():
+ADD A, Z + 1
+INT Z + 0xA0
+JMP Z + storm
+handler():
+ADD B, Z + 1
+IRET
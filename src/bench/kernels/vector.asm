@@ -0,0 +1,18 @@
+start():
+MOV F, Z + 1
+SHL F, Z + 16
+VBRD8 V2, Z + 0x55
+sum():
+MOV A, F
+MOV C, Z + 1024
+VXOR64 V1, V1
+block():
+VLD V0, A + 0
+VADD32 V1, V0
+VCEQ8 V0, V2
+VSUB8 V1, V0
+ADD A, Z + 32
+SUB C, Z + 1
+JGT Z + block
+VGET64 B, V1 + 0
+JMP Z + sum
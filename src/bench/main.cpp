@@ -0,0 +1,184 @@
+#include "src/emulator/cpu.hpp"
+#include "src/common/defs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Interpreter microbenchmarks, each guest is hand encoded so the bench does
+// not depend on the assembler. Guest kernels from src/bench/kernels follow,
+// assembled at build time:
+// - alu: dependent arithmetic and logic
+// - memcpy: 32KiB copied a word at a time
+// - bulkcopy: the same 32KiB copied by one MCPY
+// - vector: 32KiB summed and compared 32 bytes per instruction
+// - paged: a load and store on each of 1008 mapped pages, all TLB misses
+// - syscall: INT storm with a two instruction handler
+// - interp: bytecode interpreter dispatching through a jump table
+// Output is one "name value" line per result.
+
+#ifndef IDEALVM_BENCH_KERNELS
+#define IDEALVM_BENCH_KERNELS "bench_kernels"
+#endif
+
+constexpr uint32_t loopAddress = 0x100;
+constexpr uint32_t handlerAddress = 0x200;
+constexpr uint32_t jumpTable = 0x3000;
+constexpr uint64_t nInstructions = 30'000'000;
+constexpr size_t forkMemory = 64 << 20;
+constexpr int nForks = 1000;
+constexpr uint64_t instructionsPerFork = 1000;
+constexpr size_t kernelMemory = 8 << 20;
+
+static void emit(CPU &cpu, uint32_t &address, const Op op, const uint8_t r0,
+                 const uint8_t r1, const int16_t offset){
+  (*cpu.memory)[address++] = op;
+  (*cpu.memory)[address++] = (r0 << 4) | r1;
+  (*cpu.memory)[address++] = static_cast<uint16_t>(offset) >> 8;
+  (*cpu.memory)[address++] = static_cast<uint16_t>(offset) & 0xFF;
+}
+
+static CPU makeCPU(void){
+  CPU::State s{};
+  s.ip = loopAddress;
+  s.registers[Reg::SP] = 0x7000;
+  s.protectedReg[PSP] = 0x8000;
+  s.protectedReg[IJT] = jumpTable;
+
+  return CPU(s, 0x10000);
+}
+
+static double nsPerInstruction(CPU &cpu){
+  const auto start = std::chrono::steady_clock::now();
+  cpu.run(nInstructions);
+  const auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / nInstructions;
+}
+
+// Short jobs forked from one booted guest, each dirties a single page
+static double usPerFork(const CPU::Snapshot &snapshot){
+  const auto start = std::chrono::steady_clock::now();
+  for(int i{0}; i < nForks; i++){
+    CPU job(snapshot);
+    job.run(instructionsPerFork);
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / nForks;
+}
+
+// Snapshots of a running guest between short slices, each dirties one page
+static double usPerSnapshot(CPU &booted){
+  double total{0};
+  for(int i{0}; i < nForks; i++){
+    booted.run(instructionsPerFork);
+    const auto start = std::chrono::steady_clock::now();
+    const CPU::Snapshot snapshot = booted.snapshot();
+    total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return total / nForks;
+}
+
+// Kernels loop forever, so a fixed budget runs the same instructions every time
+static bool runKernel(const std::filesystem::path &image){
+  const std::string name = image.stem().string();
+
+  CPU cpu(CPU::State{}, kernelMemory);
+  if(!cpu.memory->mapImage(image)){
+    std::cerr << name << ": Failed to load " << image.string() << "\n";
+    return false;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const StopReason reason = cpu.run(nInstructions);
+  const auto end = std::chrono::steady_clock::now();
+
+  if(reason != StopReason::BUDGET_EXHAUSTED){
+    std::cerr << name << ": Stopped after " << cpu.retired << " instructions\n";
+    return false;
+  }
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+
+  std::cout << "kernel_" << name << "_mips " << nInstructions / seconds / 1e6 << "\n";
+  std::cout << "kernel_" << name << "_ns_per_inst " << seconds * 1e9 / nInstructions << "\n";
+  std::cout << "kernel_" << name << "_page_walks_per_s " << cpu.pageWalks / seconds << "\n";
+  return true;
+}
+
+int main(int argc, char *argv[]){
+  // ADD A, Z + 1; JMP Z + loop
+  CPU alu = makeCPU();
+  uint32_t address = loopAddress;
+  emit(alu, address, Op::ADD, Reg::A, Reg::Z, 1);
+  emit(alu, address, Op::JMP, 0, Reg::Z, loopAddress);
+
+  // INT Z + 0xA0; JMP Z + loop, handler is a lone IRET
+  CPU storm = makeCPU();
+  address = loopAddress;
+  emit(storm, address, Op::INT, 0, Reg::Z, IntCode::SOFTWARE_INTERUPT_START);
+  emit(storm, address, Op::JMP, 0, Reg::Z, loopAddress);
+  address = handlerAddress;
+  emit(storm, address, Op::IRET, 0, 0, 0);
+  (*storm.memory)[jumpTable + IntCode::SOFTWARE_INTERUPT_START*8] = handlerAddress & 0xFF;
+  (*storm.memory)[jumpTable + IntCode::SOFTWARE_INTERUPT_START*8 + 1] = handlerAddress >> 8;
+
+  // ADD A, Z + 1; SD A, Z + 0x4000; JMP Z + loop, booted in a large guest
+  CPU::State forkState{};
+  forkState.ip = loopAddress;
+  CPU booted(forkState, forkMemory);
+  address = loopAddress;
+  emit(booted, address, Op::ADD, Reg::A, Reg::Z, 1);
+  emit(booted, address, Op::SD, Reg::A, Reg::Z, 0x4000);
+  emit(booted, address, Op::JMP, 0, Reg::Z, loopAddress);
+  booted.run(instructionsPerFork);
+  const CPU::Snapshot snapshot = booted.snapshot();
+
+  const double aluNs = nsPerInstruction(alu);
+  const double stormNs = nsPerInstruction(storm);
+  const double forkUs = usPerFork(snapshot);
+  const double snapshotUs = usPerSnapshot(booted);
+
+  // Every third instruction of the storm is an INT
+  std::cout << "alu_loop_ns_per_inst " << aluNs << "\n";
+  std::cout << "int_storm_ns_per_inst " << stormNs << "\n";
+  std::cout << "int_storm_ns_per_int " << stormNs * 3 << "\n";
+  std::cout << "fork_us " << forkUs << "\n";
+  std::cout << "snapshot_us " << snapshotUs << "\n";
+
+  if(alu.st.registers[Reg::A] != nInstructions / 2){
+    std::cerr << "alu_loop produced the wrong result\n";
+    return EXIT_FAILURE;
+  }
+
+  // Sorted so results always come out in the same order
+  const std::filesystem::path kernelDirectory = argc > 1 ? argv[1] : IDEALVM_BENCH_KERNELS;
+  std::vector<std::filesystem::path> kernels{};
+  std::error_code error;
+
+  for(const auto &entry : std::filesystem::directory_iterator(kernelDirectory, error)){
+    if(entry.path().extension() == ".bin"){
+      kernels.push_back(entry.path());
+    }
+  }
+  std::sort(kernels.begin(), kernels.end());
+
+  if(kernels.empty()){
+    std::cerr << "No kernels found in " << kernelDirectory.string() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  bool failed{false};
+  for(const auto &kernel : kernels){
+    failed |= !runKernel(kernel);
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Side file written by the assembler's -m flag, mapping image addresses
+// back to labels and source lines. Every table is sorted by address and 4
+// byte aligned, so readers binary search it in place from an mmap.
+//
+// Layout, in the byte order of the host that assembled it:
+//   DebugMapHeader
+//   DebugMapSymbol[symbolCount]
+//   DebugMapLine[lineCount]
+//   char strings[stringBytes], names are not null terminated
+inline constexpr char DEBUG_MAP_MAGIC[8] = {'I', 'V', 'M', 'D', 'B', 'G', '0', '1'};
+
+struct DebugMapHeader {
+  char magic[8];
+  uint32_t symbolCount;
+  uint32_t lineCount;
+  uint32_t stringBytes;
+  uint32_t sourceName; // Assembled file name, offset into strings
+  uint32_t sourceNameLength;
+  uint32_t reserved{0};
+};
+
+// A labelled region of the image
+struct DebugMapSymbol {
+  uint32_t address;
+  uint32_t nBytes;
+  uint32_t name; // Offset into strings
+  uint32_t nameLength;
+};
+
+// One per instruction, data has no entries
+struct DebugMapLine {
+  uint32_t address;
+  uint32_t line; // 1-based
+};
@@ -12,6 +12,7 @@ namespace EF {
   inline constexpr uint64_t PROTECTED_ENABLE = 0x8000000000000000;
   inline constexpr uint64_t PAGING_ENABLE = 0x4000000000000000;
   inline constexpr uint64_t INTERRUPT_ENABLE = 0x2000000000000000;
+  inline constexpr uint64_t COUNTER_ACCESS = 0x1000000000000000; // PRD of the performance counters allowed with protection
 }
 
 // Page entry masks
@@ -25,6 +26,44 @@ namespace PE {
   inline constexpr uint32_t ACCESSED = 0x20;
 }
 
+// Physical addresses of the emulator's memory-mapped devices, one page each.
+// RAM takes precedence, so they are only reachable with less than 4GiB - 64KiB.
+namespace MMIO {
+  inline constexpr uint32_t REGION_SIZE = 0x1000;
+  inline constexpr uint32_t CONSOLE = 0xFFFF0000;
+  inline constexpr uint32_t TIMER = 0xFFFF1000;
+  inline constexpr uint32_t BLOCK = 0xFFFF2000;
+
+  // Console registers, any access width
+  inline constexpr uint32_t CONSOLE_DATA = 0x0;   // Writes print the low byte, reads take an input byte or all ones if none is ready
+  inline constexpr uint32_t CONSOLE_FLUSH = 0x8;  // Writes flush buffered output
+  inline constexpr uint32_t CONSOLE_STATUS = 0x10; // Read only, see CONSOLE_INPUT_READY and CONSOLE_INPUT_CLOSED
+
+  inline constexpr uint64_t CONSOLE_INPUT_READY = 0x1;
+  inline constexpr uint64_t CONSOLE_INPUT_CLOSED = 0x2; // End of input, nothing more will arrive
+
+  // Timer registers, 8 byte accesses only
+  inline constexpr uint32_t TIMER_INTERVAL = 0x0; // Same as the TIMER protected register
+  inline constexpr uint32_t TIMER_PENDING = 0x8;  // 1 while a tick waits for interrupts, write 0 to drop it
+
+  // Block device registers, 8 byte accesses only. Writing a command moves
+  // COUNT sectors starting at SECTOR between the disk and the physical
+  // address BUFFER, then raises BLOCK_COMPLETE. A read that fails with
+  // BLOCK_ERROR may have filled part of BUFFER, the rest is left as it was.
+  inline constexpr uint32_t BLOCK_SECTOR = 0x0;
+  inline constexpr uint32_t BLOCK_COUNT = 0x8;
+  inline constexpr uint32_t BLOCK_BUFFER = 0x10;
+  inline constexpr uint32_t BLOCK_COMMAND = 0x18;  // Write only, see BLOCK_READ and BLOCK_WRITE
+  inline constexpr uint32_t BLOCK_STATUS = 0x20;   // Read only, reading drops an undelivered BLOCK_COMPLETE
+  inline constexpr uint32_t BLOCK_CAPACITY = 0x28; // Read only, in sectors
+
+  inline constexpr uint64_t BLOCK_READ = 1;  // Disk to memory
+  inline constexpr uint64_t BLOCK_WRITE = 2; // Memory to disk
+  inline constexpr uint64_t BLOCK_OK = 0;
+  inline constexpr uint64_t BLOCK_ERROR = 1; // Bad command, range outside disk or memory, or host I/O error
+  inline constexpr uint32_t BLOCK_SECTOR_SIZE = 512;
+}
+
 // Register names (4bit max)
 enum Reg : uint8_t {
   // GP Registers
@@ -52,10 +91,19 @@ enum ProtectedReg : uint8_t {
   PSP, // Privileged stack pointer
   IJT, // Interrupt jump table pointer
   RPT, // Root page table pointer
+  TIMER, // Retired instructions between TIMER_CLOCK interrupts, 0 stops the timer
+
+  // Performance counters, counted since the CPU was created. Read only, PMOV
+  // to them faults.
+  RETIRED,     // Instructions retired before the reading one
+  PAGE_FAULTS, // PAGE_FAULTs taken
+  TLB_MISSES,  // Translations that had to walk the page table
+  INTERRUPTS,  // Faults and interrupts taken, PAGE_FAULTs included
 };
 
 // Opcodes occupying the upper byte of an instruction
-// Of form: (rroooooo) where (r) = reserved, (o) = opcode
+// Of form: (wwoooooo) where (w) = lane width of vector ops, reserved
+// otherwise, and (o) = opcode
 enum Op : uint8_t {
   MOV = 0b00000000,
   GEF, // Get execution flags
@@ -101,20 +149,65 @@ enum Op : uint8_t {
   // Privileged instructions
   PMOV, // Privileged register move
   IRET, // Interrupt return
+  HLT, // Halt the processor
+
+  BRK, // Breakpoint, returns control to the host
+
+  // Atomic read-modify-write on an aligned 64 bit word at r1 + offset
+  CAS,  // If the word equals A, store r0. A gets the old word, flags as SUB old, A
+  FADD, // Add r0 to the word, r0 gets the old word
+
+  PRD, // Read protected register r1 into r0, privileged unless reading a counter with EF::COUNTER_ACCESS
+
+  // Bulk memory, written "MCPY dst, src, length" with the length register in
+  // the low 4 bits of the offset. The length shrinks as bytes are done, and
+  // forward copies and fills also advance dst and src past them, so the
+  // instruction restarts where a fault left it. Each execution moves a
+  // bounded chunk and then runs again until the length is zero.
+  MCPY, // Copy length bytes from src to dst, overlapping ranges like memmove
+  MSET, // Fill length bytes at dst with the low byte of src
+
+  // Vector registers V0-V15 of 32 bytes, accessed as one 32 byte aligned block
+  VLD, // Load v0 from r1 + offset
+  VST, // Store v0 to r1 + offset
+
+  // Lanewise, the lane width is 8 << (w) bits
+  VADD, // v0 = v0 op v1
+  VSUB,
+  VAND,
+  VOR,
+  VXOR,
+  VSHL, // v0 = v1 shifted by offset, lanes are cleared by shifts of their width or more
+  VSHR,
+  VCEQ, // Lanes of v0 all ones where the comparison holds, zero otherwise
+  VCGT, // Signed v0 > v1
+  VBRD, // Every lane of v0 = r1 + offset
+  VGET, // r0 = lane (offset) of v1, zero extended
 };
 
+inline constexpr uint8_t OPCODE_MASK = 0x3F;
+inline constexpr uint8_t LANE_WIDTH_SHIFT = 6;
+
+// Only these read (w), every other opcode with it set is invalid
+inline constexpr bool hasLaneWidth(const uint8_t opcode){
+  return opcode >= Op::VADD && opcode <= Op::VGET;
+}
+
 enum IntCode : uint8_t {
   // Faults, all resume at the faulting instruction
   FAULT_START = 0x0,
   PAGE_FAULT = 0x0,
   INSTRUCTION_FAULT,  
   ALU_FAULT,
+  BUS_FAULT, // Physical address outside of memory
+  ALIGNMENT_FAULT, // Atomic access not 8 byte aligned, vector access not 32 byte aligned
 
   FAULT_END = 0x1F,
 
   // HW Interrupts, resume at the next instruction
   HW_INTERRUPT_START = 0x20, 
   TIMER_CLOCK = 0x20,  
+  BLOCK_COMPLETE, // Block device command finished, see MMIO::BLOCK_STATUS
 
   HW_INTERRUPT_END = 0x9F,
 
@@ -0,0 +1,404 @@
+#include "src/emulator/cpu.hpp"
+#include "src/emulator/jit.hpp"
+#include "src/emulator/vector.hpp"
+#include "src/common/defs.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Differential tester. Random guest programs run on two engines from the
+// same state, and both must end with the same registers, vectors, flags,
+// memory, stop reason and guest visible counters:
+// - jit: the interpreter against the JIT, entered in random slice sizes
+// - fused: one run over the whole budget against run(1) steps. A one
+//   instruction budget stops between the halves of a fused pair, so the
+//   steps execute the program unfused.
+// Programs are short counted loops of random instructions, which also
+// store into their own code. Programs cycle through three paging modes:
+// - off: physical addresses throughout
+// - on: a second virtual page aliases the code frame
+// - iret: paging starts off and every pass over the code ends in a
+//   software interrupt whose handler flips paging in the EFLAGS it
+//   returns to, so the same code is compiled in one mode and run in the
+//   other. The alias page physically holds a second copy of the loops
+//   with other instructions, so code that runs without paging where it
+//   should go through the alias shows up. These programs only use
+//   register instructions, memory writes could break the loops.
+// Separately every lane kernel of each SIMD backend the host has is
+// checked against the scalar one on random vectors, both engines above
+// run on the same backend and can not tell a wrong kernel apart.
+// Usage: difftest [programs] [seed]. Output is one "name value" line per
+// result, the exit status is nonzero on any mismatch.
+
+constexpr size_t guestMemory = 0x10000;
+constexpr uint32_t codeEnd = 0x600; // Random code, the interrupt handler follows
+constexpr uint32_t dataStart = 0x4000;
+constexpr uint32_t jumpTable = 0x6000;
+constexpr uint32_t pageTable = 0x8000; // Directory, its one table follows
+constexpr uint32_t aliasPage = 0x7000; // Maps the code frame when paging, in reach of immediates
+constexpr uint32_t returnHash = 0x5FF8; // Folded return addresses of the interrupt handler
+constexpr uint64_t maxBudget = 20000;
+constexpr int maxReported = 5;
+
+enum class Paging { OFF, ON, IRET };
+
+// Weighted towards the ops that the JIT compiles natively and the pairs
+// that decode fuses
+constexpr uint8_t programOps[] = {
+  Op::MOV, Op::MOV, Op::GEF,
+  Op::LB, Op::LBU, Op::LH, Op::LHU, Op::LW, Op::LWU, Op::LD, Op::LD,
+  Op::SB, Op::SH, Op::SW, Op::SD, Op::SD,
+  Op::PUSH, Op::PUSH, Op::POP, Op::POP,
+  Op::JMP, Op::JLT, Op::JGT, Op::JZR, Op::JIF, Op::JLT, Op::JZR, Op::JGT,
+  Op::AND, Op::OR, Op::XOR, Op::SHL, Op::SHR,
+  Op::ADD, Op::ADD, Op::ADD, Op::SUB, Op::SUB, Op::SUB,
+  Op::MUL, Op::SMUL, Op::DIV, Op::SDIV, Op::SSHR,
+  Op::INT, Op::CAS, Op::FADD, Op::MCPY, Op::MSET,
+  Op::VLD, Op::VST, Op::VADD, Op::VSUB, Op::VAND, Op::VOR, Op::VXOR,
+  Op::VSHL, Op::VSHR, Op::VCEQ, Op::VCGT, Op::VBRD, Op::VGET,
+};
+
+constexpr uint8_t registerOps[] = {
+  Op::MOV, Op::GEF, Op::AND, Op::OR, Op::XOR, Op::SHL, Op::SHR,
+  Op::ADD, Op::ADD, Op::SUB, Op::SUB, Op::MUL, Op::SMUL, Op::DIV, Op::SSHR,
+};
+
+static void emit(CPU &cpu, const uint32_t address, const uint8_t op, const uint8_t r0,
+                 const uint8_t r1, const int16_t offset){
+  (*cpu.memory)[address] = op;
+  (*cpu.memory)[address + 1] = (r0 << 4) | r1;
+  (*cpu.memory)[address + 2] = static_cast<uint16_t>(offset) >> 8;
+  (*cpu.memory)[address + 3] = static_cast<uint16_t>(offset) & 0xFF;
+}
+
+static void store32(CPU &cpu, const uint32_t address, const uint32_t value){
+  std::memcpy(cpu.memory->data() + address, &value, 4);
+}
+
+// A program and its starting state, loaded into a fresh CPU per engine
+struct Program {
+  CPU::State state{};
+  std::vector<uint8_t> memory;
+  uint64_t budget{};
+};
+
+// Where a jump to code lands, sometimes the alias of the code frame
+static uint32_t aliasOffset(std::mt19937_64 &rng, const Paging paging){
+  return paging != Paging::OFF && rng() % 2 ? aliasPage : 0;
+}
+
+static void emitRandom(CPU &cpu, std::mt19937_64 &rng, const uint32_t address, const Paging paging){
+  uint8_t op = programOps[rng() % std::size(programOps)];
+  uint8_t r0 = rng() % 16;
+  uint8_t r1 = rng() % 16;
+
+  // Register only code that keeps its loop counts, so nothing overwrites
+  // the code and every pass gets to the software interrupt flipping paging
+  if(paging == Paging::IRET){
+    op = registerOps[rng() % std::size(registerOps)];
+    while(r0 == Reg::K || r1 == Reg::K){
+      r0 = rng() % 16;
+      r1 = rng() % 16;
+    }
+  }
+
+  int16_t offset = static_cast<int16_t>(rng() % 64) - 32;
+
+  if(op >= Op::JMP && op <= Op::JIF && rng() % 4){
+    r1 = Reg::Z;
+    offset = static_cast<int16_t>((rng() % codeEnd & ~uint32_t{3}) + aliasOffset(rng, paging));
+  }
+  else if(op == Op::INT){
+    r1 = Reg::Z;
+    offset = IntCode::SOFTWARE_INTERUPT_START;
+  }
+  // Mostly the data area, sometimes the code itself
+  else if(((op >= Op::LB && op <= Op::SD) || op == Op::VLD || op == Op::VST) && rng() % 3){
+    r1 = Reg::Z;
+    offset = static_cast<int16_t>(rng() % 8 ? dataStart + rng() % pageSize : rng() % codeEnd);
+    if(op == Op::VLD || op == Op::VST){
+      offset &= ~int16_t{sizeof(Vector) - 1};
+    }
+  }
+
+  if(hasLaneWidth(op)){
+    op |= (rng() % laneWidths) << LANE_WIDTH_SHIFT;
+  }
+  emit(cpu, address, op, r0, r1, offset);
+}
+
+// Short loops of random instructions, each counted down in K. With paging
+// the branch back may go through the alias, so the same code runs hot
+// under two virtual addresses. The loops are placed by layout, so code
+// emitted from the same layout seed has its loops at the same offsets.
+static void emitCode(CPU &cpu, std::mt19937_64 layout, std::mt19937_64 &rng,
+                     const uint32_t base, const Paging paging){
+  // With iret paging the last three slots are left for the interrupt
+  const uint32_t loopsEnd = paging == Paging::IRET ? codeEnd - 12 : codeEnd;
+  uint32_t address{0};
+  while(address + 4 * 16 <= loopsEnd){
+    // Short enough with iret paging that a pass, and so a flip, is well
+    // within the budget
+    const uint64_t count = 1 + layout() % (paging == Paging::IRET ? 8 : 40);
+    emit(cpu, base + address, Op::MOV, Reg::K, Reg::Z, static_cast<int16_t>(count));
+    address += 4;
+
+    const uint32_t body = address;
+    for(uint64_t n = 1 + layout() % 12; n; n--){
+      emitRandom(cpu, rng, base + address, paging);
+      address += 4;
+    }
+
+    emit(cpu, base + address, Op::SUB, Reg::K, Reg::Z, 1);
+    // With iret paging the loop alternates between its two copies, so
+    // without paging the code frame's copy is compiled chained to the
+    // alias page's, which it must not be once paging turns on
+    const uint32_t back = paging == Paging::IRET ? aliasPage - base : aliasOffset(rng, paging);
+    emit(cpu, base + address + 4, Op::JGT, 0, Reg::Z, static_cast<int16_t>(body + back));
+    address += 8;
+  }
+  for(; address < codeEnd - 4; address += 4){
+    emitRandom(cpu, rng, base + address, paging);
+  }
+  // The handler returns past the slot after the interrupt
+  if(paging == Paging::IRET){
+    emit(cpu, base + codeEnd - 12, Op::INT, 0, Reg::Z, IntCode::SOFTWARE_INTERUPT_START);
+  }
+  emit(cpu, base + address, Op::JMP, 0, Reg::Z, static_cast<int16_t>(aliasOffset(rng, paging)));
+}
+
+static Program generate(std::mt19937_64 &rng, const Paging paging){
+  CPU::State s{};
+  for(uint8_t r{0}; r < Reg::Z; r++){
+    s.registers[r] = rng() % 4 ? rng() % 0x3000 : rng();
+  }
+  s.registers[Reg::SP] = 0x7000;
+  s.protectedReg[PSP] = 0x5800;
+  s.protectedReg[IJT] = jumpTable;
+
+  CPU cpu(s, guestMemory);
+
+  // Identity maps the whole guest, plus aliasPage onto the code
+  if(paging != Paging::OFF){
+    if(paging == Paging::ON){
+      cpu.st.protectedReg[EFLAGS] |= EF::PAGING_ENABLE;
+    }
+    cpu.st.protectedReg[RPT] = pageTable;
+    store32(cpu, pageTable, (pageTable + pageSize) | PE::OCCUPIED | PE::WRITABLE | PE::EXECUTABLE);
+    for(uint32_t page{0}; page < guestMemory / pageSize; page++){
+      store32(cpu, pageTable + pageSize + page * 4,
+              page << pageShift | PE::OCCUPIED | PE::WRITABLE | PE::EXECUTABLE);
+    }
+    store32(cpu, pageTable + pageSize + (aliasPage >> pageShift) * 4,
+            PE::OCCUPIED | PE::WRITABLE | PE::EXECUTABLE);
+  }
+
+  const std::mt19937_64 layout(rng());
+  emitCode(cpu, layout, rng, 0, paging);
+  if(paging == Paging::IRET){
+    emitCode(cpu, layout, rng, aliasPage, paging);
+  }
+
+  // Every interrupt and fault returns past the instruction it would resume
+  // at, so faulting code moves on. The return addresses are also hashed
+  // into memory, so a wrong ip anywhere shows up at the end.
+  // With iret paging, software interrupts enter through a prologue that
+  // flips paging in the EFLAGS the handler returns to. Faults do not flip,
+  // they are too frequent to leave much code run in either mode.
+  uint32_t address = codeEnd;
+  if(paging == Paging::IRET){
+    emit(cpu, address, Op::LD, Reg::X, Reg::SP, 0);
+    emit(cpu, address += 4, Op::MOV, Reg::Y, Reg::Z, 1);
+    emit(cpu, address += 4, Op::SHL, Reg::Y, Reg::Z, 62); // EF::PAGING_ENABLE
+    emit(cpu, address += 4, Op::XOR, Reg::X, Reg::Y, 0);
+    emit(cpu, address += 4, Op::SD, Reg::X, Reg::SP, 0);
+    address += 4;
+  }
+  const uint32_t handler = address;
+  emit(cpu, address, Op::LD, Reg::Y, Reg::SP, 8);
+  emit(cpu, address += 4, Op::ADD, Reg::Y, Reg::Z, 4);
+  emit(cpu, address += 4, Op::SD, Reg::Y, Reg::SP, 8);
+  emit(cpu, address += 4, Op::LD, Reg::X, Reg::Z, returnHash);
+  emit(cpu, address += 4, Op::MUL, Reg::X, Reg::Z, 31);
+  emit(cpu, address += 4, Op::ADD, Reg::X, Reg::Y, 0);
+  emit(cpu, address += 4, Op::SD, Reg::X, Reg::Z, returnHash);
+  emit(cpu, address += 4, Op::IRET, 0, 0, 0);
+  for(uint32_t code{0}; code < 256; code++){
+    store32(cpu, jumpTable + code * 8, code == IntCode::SOFTWARE_INTERUPT_START ? codeEnd : handler);
+  }
+
+  Program program{};
+  program.state = cpu.st;
+  program.memory.assign(cpu.memory->data(), cpu.memory->data() + guestMemory);
+  program.budget = 1 + rng() % maxBudget;
+  return program;
+}
+
+static void load(CPU &cpu, const Program &program){
+  std::memcpy(cpu.memory->data(), program.memory.data(), guestMemory);
+}
+
+// Empty when both engines agree, otherwise what differs first
+static std::string compare(const CPU &a, const StopReason reasonA,
+                           const CPU &b, const StopReason reasonB){
+  if(reasonA != reasonB){
+    return "stop reason";
+  }
+  if(a.retired != b.retired){
+    return "retired " + std::to_string(a.retired) + " vs " + std::to_string(b.retired);
+  }
+  if(a.st.ip != b.st.ip){
+    return "ip";
+  }
+  // Guests read these through PRD
+  if(a.pageWalks != b.pageWalks){
+    return "page walks " + std::to_string(a.pageWalks) + " vs " + std::to_string(b.pageWalks);
+  }
+  if(a.pageFaults != b.pageFaults){
+    return "page faults";
+  }
+  if(a.interruptsTaken != b.interruptsTaken){
+    return "interrupts taken";
+  }
+  for(uint8_t r{0}; r < 16; r++){
+    if(a.st.registers[r] != b.st.registers[r]){
+      return "register " + std::to_string(r);
+    }
+  }
+  for(uint8_t r{0}; r < 16; r++){
+    if(a.st.protectedReg[r] != b.st.protectedReg[r]){
+      return "protected register " + std::to_string(r);
+    }
+  }
+  for(uint8_t v{0}; v < 16; v++){
+    if(std::memcmp(&a.st.vectors[v], &b.st.vectors[v], sizeof(Vector))){
+      return "vector " + std::to_string(v);
+    }
+  }
+  for(size_t address{0}; address < guestMemory; address++){
+    if((*a.memory)[address] != (*b.memory)[address]){
+      return "memory at " + std::to_string(address);
+    }
+  }
+  return "";
+}
+
+// The JIT gets the same budget in random slices, so blocks are also
+// entered with little of it left
+static std::string runJIT(const Program &program, std::mt19937_64 &rng){
+  CPU interpreted(program.state, guestMemory);
+  load(interpreted, program);
+  const StopReason expected = interpreted.run(program.budget);
+
+  CPU compiled(program.state, guestMemory);
+  load(compiled, program);
+  JIT jit(compiled);
+  StopReason reason{StopReason::BUDGET_EXHAUSTED};
+
+  for(uint64_t left{program.budget}; left;){
+    const uint64_t before = compiled.retired;
+    reason = jit.run(std::min(left, 1 + rng() % 3000));
+    left -= compiled.retired - before;
+    if(reason != StopReason::BUDGET_EXHAUSTED){
+      break;
+    }
+  }
+
+  return compare(interpreted, expected, compiled, reason);
+}
+
+static std::string runFused(const Program &program){
+  CPU fused(program.state, guestMemory);
+  load(fused, program);
+  const StopReason expected = fused.run(program.budget);
+
+  CPU stepped(program.state, guestMemory);
+  load(stepped, program);
+  StopReason reason{StopReason::BUDGET_EXHAUSTED};
+
+  for(uint64_t step{0}; step < program.budget && reason == StopReason::BUDGET_EXHAUSTED; step++){
+    reason = stepped.run(1);
+  }
+
+  return compare(fused, expected, stepped, reason);
+}
+
+// Shift amounts are drawn around the lane widths, where kernels clamp
+static int checkVectorBackend(const VectorBackend backend, std::mt19937_64 &rng){
+  const LaneKernels reference = laneKernels(VectorBackend::SCALAR);
+  const LaneKernels kernels = laneKernels(backend);
+  int mismatches{0};
+
+  for(size_t op{0}; op < static_cast<size_t>(LaneOp::COUNT); op++){
+    for(uint32_t width{0}; width < laneWidths; width++){
+      for(int trial{0}; trial < 1000; trial++){
+        Vector d{};
+        Vector s{};
+        for(size_t i{0}; i < sizeof(Vector); i++){
+          d.bytes[i] = rng();
+          // Equal lanes are rare otherwise, CEQ and CGT need them
+          s.bytes[i] = rng() % 4 ? rng() : d.bytes[i];
+        }
+        const uint64_t amount = rng() % 8 ? rng() % 72 : rng();
+
+        Vector expected = d;
+        Vector result = d;
+        reference[op][width](expected, s, amount);
+        kernels[op][width](result, s, amount);
+
+        if(std::memcmp(&expected, &result, sizeof(Vector)) && mismatches++ < maxReported){
+          std::cerr << "vector: " << vectorBackendName(backend) << " op " << op
+                    << " width " << width << " amount " << amount << " differs\n";
+        }
+      }
+    }
+  }
+  return mismatches;
+}
+
+int main(int argc, char *argv[]){
+  const int programs = argc > 1 ? std::atoi(argv[1]) : 2000;
+  std::mt19937_64 rng(argc > 2 ? std::strtoull(argv[2], nullptr, 0) : 1);
+
+  if(!JIT::supported()){
+    std::cerr << "The JIT is not available in this build, jit runs only the interpreter\n";
+  }
+
+  int jitMismatches{0};
+  int fusedMismatches{0};
+
+  for(int i{0}; i < programs; i++){
+    const Program program = generate(rng, static_cast<Paging>(i % 3));
+
+    const std::string jitDifference = runJIT(program, rng);
+    if(!jitDifference.empty() && jitMismatches++ < maxReported){
+      std::cerr << "jit: program " << i << " differs in " << jitDifference << "\n";
+    }
+
+    const std::string fusedDifference = runFused(program);
+    if(!fusedDifference.empty() && fusedMismatches++ < maxReported){
+      std::cerr << "fused: program " << i << " differs in " << fusedDifference << "\n";
+    }
+  }
+
+  // Backends are ordered, the host has every one up to its best
+  int vectorMismatches{0};
+  for(const VectorBackend backend : {VectorBackend::SSE2, VectorBackend::AVX2}){
+    if(backend <= hostVectorBackend()){
+      vectorMismatches += checkVectorBackend(backend, rng);
+    }
+  }
+
+  std::cout << "programs " << programs << "\n";
+  std::cout << "jit_mismatches " << jitMismatches << "\n";
+  std::cout << "fused_mismatches " << fusedMismatches << "\n";
+  std::cout << "vector_mismatches " << vectorMismatches << "\n";
+
+  return jitMismatches || fusedMismatches || vectorMismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#include "bus.hpp"
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+bool Bus::attach(const uint32_t base, const uint32_t size, std::shared_ptr<Device> device){
+  const uint64_t end = uint64_t{base} + size;
+
+  if(size == 0 || end > uint64_t{UINT32_MAX} + 1 || !device){
+    return false;
+  }
+
+  for(const Region &region : regions){
+    if(base < uint64_t{region.base} + region.size && region.base < end){
+      return false;
+    }
+  }
+
+  regions.push_back(Region{base, size, std::move(device)});
+  return true;
+}
+
+// Only a handful of devices exist, a linear scan beats anything fancier
+const Bus::Region *Bus::find(const uint32_t address, const uint8_t nBytes) const{
+  for(const Region &region : regions){
+    if(address >= region.base && uint64_t{address} + nBytes <= uint64_t{region.base} + region.size){
+      return &region;
+    }
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+struct CPU;
+
+// A memory-mapped device. Accesses are 1, 2, 4 or 8 bytes, lie entirely
+// inside the device's region and are given relative to its base. The CPU
+// performing the access is passed along so devices can act on it. Harts of
+// a Machine share the bus, so devices with state must be thread-safe.
+struct Device {
+  virtual ~Device() = default;
+
+  // nullopt or false raise a bus fault on the accessing CPU
+  virtual std::optional<uint64_t> read(CPU &cpu, const uint32_t offset, const uint8_t nBytes) = 0;
+  virtual bool write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value) = 0;
+};
+
+// Physical addresses past the end of memory. RAM is checked first and
+// shadows any region it overlaps, so device support costs plain memory
+// accesses nothing.
+struct Bus {
+  struct Region {
+    uint32_t base;
+    uint32_t size;
+    std::shared_ptr<Device> device;
+  };
+
+  std::vector<Region> regions;
+
+  // False if the region is empty, wraps or overlaps another one
+  bool attach(const uint32_t base, const uint32_t size, std::shared_ptr<Device> device);
+  // Region holding all of [address, address + nBytes), if any
+  const Region *find(const uint32_t address, const uint8_t nBytes) const;
+};
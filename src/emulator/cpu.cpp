@@ -1,247 +1,1263 @@
 #include "cpu.hpp"
+#include "jit.hpp"
 #include "src/common/defs.hpp"
 #include <cstdint>
 #include <algorithm>
-#include <stdexcept>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
 
 constexpr uint64_t msbMask = 0x8000000000000000;  
 
-CPU::CPU(CPU::State s, const size_t memSize) 
-  : st{s}, memory(memSize) {};
+// Statements only compiled into profiling builds
+#ifdef IDEALVM_PROFILE
+#define PROFILE(statement) statement
+#else
+#define PROFILE(statement)
+#endif
 
-void CPU::progressClock(void){
-  try{
-    const uint32_t instruction = fetchInstruction();
-    dispatchInstruction(instruction);
+// Instructions are stored opcode first, so read the word big-endian.
+// Aligned words are read atomically as other harts may be writing them.
+static uint32_t instructionWord(uint8_t *bytes){
+  uint32_t word;
+  if(reinterpret_cast<uintptr_t>(bytes) % 4 == 0){
+    word = std::atomic_ref(*reinterpret_cast<uint32_t *>(bytes)).load(std::memory_order_relaxed);
   }
-  catch(Interrupt &i){
-    handleInterrupt(i);
-  }
-  catch(std::out_of_range &e){
-    //TODO:
+  else{
+    std::memcpy(&word, bytes, 4);
   }
 
-  if(nipSet){
-    nipSet = false;
-    st.ip = nip;
+  if constexpr(std::endian::native == std::endian::little){
+    word = std::byteswap(word);
   }
-  else{
-    st.ip += 4;
+
+  return word;
+}
+
+static void fusePairs(DecodedPage &page); // Next to the opcode tables
+
+CPU::CPU(CPU::State s, const size_t memSize) 
+  : CPU(s, std::make_shared<GuestMemory>(memSize)) {};
+
+CPU::CPU(CPU::State s, std::shared_ptr<GuestMemory> sharedMemory)
+  : st{s}, memory{std::move(sharedMemory)},
+    decodedPages((memory->size() + pageSize - 1) / pageSize) {};
+
+CPU::CPU(const Snapshot &snapshot)
+  : st{snapshot.st}, memory{std::make_shared<GuestMemory>(snapshot.memory)},
+    nip{snapshot.nip}, nipSet{snapshot.nipSet},
+    handlingInterrupt{snapshot.handlingInterrupt},
+    halted{snapshot.halted}, retired{snapshot.retired},
+    pageFaults{snapshot.pageFaults}, pageWalks{snapshot.pageWalks},
+    interruptsTaken{snapshot.interruptsTaken},
+    timerCountdown{snapshot.timerCountdown}, irqPending{snapshot.irqPending},
+    decodedPages((snapshot.memory.length + pageSize - 1) / pageSize),
+    bus{snapshot.bus} {};
+
+// Lazy flags and pending interrupts are always settled once run returns
+CPU::Snapshot CPU::snapshot(void){
+  return Snapshot{st, nip, nipSet, handlingInterrupt, halted, timerCountdown, irqPending,
+                  retired, pageFaults, pageWalks, interruptsTaken, memory->snapshot(), bus};
+}
+
+void CPU::restore(const Snapshot &snapshot){
+  memory->restore(snapshot.memory);
+
+  st = snapshot.st;
+  nip = snapshot.nip;
+  nipSet = snapshot.nipSet;
+  handlingInterrupt = snapshot.handlingInterrupt;
+  halted = snapshot.halted;
+  timerCountdown = snapshot.timerCountdown;
+  irqPending = snapshot.irqPending;
+  retired = snapshot.retired;
+  pageFaults = snapshot.pageFaults;
+  pageWalks = snapshot.pageWalks;
+  interruptsTaken = snapshot.interruptsTaken;
+  timerRearm = false;
+  doubleFaulted = false;
+  flagsLazy = false;
+
+  flushTLB();
+  dropDecoded();
+}
+
+void CPU::progressClock(void){
+  run(1);
+}
+
+// Only the first interrupt raised by an instruction is kept
+void CPU::raise(const IntCode code, const uint64_t info){
+  if(!interruptPending){
+    interruptPending = true;
+    pendingInterrupt = Interrupt(code, info);
   }
+}
 
-  st.registers[Reg::Z] = 0;
+void CPU::requestStop(const StopReason reason){
+  stopRequested = true;
+  stopReason = reason;
 }
 
-void CPU::handleInterrupt(Interrupt &i){
+// Fatal, the guest stays at the faulting instruction and cannot be resumed
+void CPU::doubleFault(void){
+  doubleFaulted = true;
+  nipSet = true;
+  nip = st.ip;
+  requestStop(StopReason::DOUBLE_FAULT);
+}
+
+void CPU::handleInterrupt(const Interrupt &i, const uint64_t rip){
   if(handlingInterrupt){
-    throw std::runtime_error("Double fault");
+    doubleFault();
+    return;
   }
 
   handlingInterrupt = true;
+  interruptsTaken++;
+  pageFaults += i.code == IntCode::PAGE_FAULT;
+  PROFILE(profile.interrupts[i.code]++;)
   
+  materializeFlags();
   uint64_t eflags = st.protectedReg[EFLAGS];
-  uint64_t rip = st.ip;
-
-  if(i.code > IntCode::FAULT_END){
-    rip += 4;
-  }
 
   // Disable protection & interrupts
   st.protectedReg[EFLAGS] &= ~EF::PROTECTED_ENABLE;
   st.protectedReg[EFLAGS] &= ~EF::INTERRUPT_ENABLE;
+  flushFetchTranslation();
 
   // Save user SP and swap to privileged stack
   st.protectedReg[USP] = st.registers[SP];
   st.registers[SP] = st.protectedReg[PSP];
 
-  stackPush(rip);
-  stackPush(eflags);
-
   const uint64_t jumpTableEntry = st.protectedReg[IJT] + i.code * 8;
-  
-  const uint32_t jumpAddress = mLoad(resolveAddress(jumpTableEntry), 4);
+
+  std::optional<uint64_t> jumpAddress{};
+
+  if(stackPush(rip) && stackPush(eflags)){
+    const auto jumpTableAddress = resolveAddress(jumpTableEntry);
+    if(jumpTableAddress){
+      jumpAddress = mLoad<4>(jumpTableAddress.value());
+    }
+  }
+
+  // Any fault while entering the handler is fatal
+  if(!jumpAddress){
+    interruptPending = false;
+    doubleFault();
+    return;
+  }
 
   nipSet = true;
-  nip = jumpAddress;
+  nip = jumpAddress.value();
 
   return;
 }
 
-uint32_t CPU::fetchInstruction(){
-  uint32_t physicalAddress = resolveAddress(st.ip);
-  uint32_t ret{};
-  for(int i{4}; i >= 0; i--){
-    ret |= memory[physicalAddress+i];
-    ret <<= 8; 
+// Points into the decoded page, or at slowPathInst when it cannot be cached
+IDEALVM_ALWAYS_INLINE const Inst *CPU::fetchInst(const uint64_t ip){
+  // Tag keeps the low two ip bits so unaligned fetches always miss
+  if((ip & ~uint64_t{pageSize - 4}) == fetchTag.load(std::memory_order_relaxed)){
+    return &fetchDecoded->insts[(ip & (pageSize - 1)) >> 2];
   }
-  return ret;
+
+  return fetchInstSlow(ip);
+}
+
+const Inst *CPU::fetchInstSlow(const uint64_t ip){
+  // Raised by the JIT's lookup of this same fetch, walking again would count
+  // the miss twice
+  if(interruptPending){
+    slowPathInst = Inst{};
+    return &slowPathInst;
+  }
+
+  dropStaleDecoded();
+
+  // Unaligned instructions may straddle a page, decode them on every fetch
+  if(ip & 0x3){
+    slowPathInst = decodeBinRegInst(fetchInstruction(ip));
+    return &slowPathInst;
+  }
+
+  const auto physicalAddress = resolveAddress(ip, false, true);
+
+  if(!physicalAddress){
+    slowPathInst = Inst{};
+    return &slowPathInst;
+  }
+
+  const DecodedPage *page = decodePage(physicalAddress.value() >> pageShift);
+
+  if(!page){
+    slowPathInst = decodeBinRegInst(fetchInstruction(ip));
+    return &slowPathInst;
+  }
+
+  fetchTag.store(ip & ~uint64_t{pageSize - 1}, std::memory_order_relaxed);
+  fetchDecoded = page;
+  fetchPage = physicalAddress.value() >> pageShift;
+
+  // Another hart may have flagged the page stale before the tag was set
+  if(sharedMemory){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(codeStale.load(std::memory_order_relaxed)){
+      return fetchInstSlow(ip);
+    }
+  }
+
+  return &page->insts[(ip & (pageSize - 1)) >> 2];
+}
+
+uint32_t CPU::fetchInstruction(const uint64_t ip){
+  const auto physicalAddress = resolveAddress(ip, false, true);
+
+  if(!physicalAddress){
+    return 0;
+  }
+
+  if(physicalAddress.value() + 4ull > memory->size()){
+    raise(IntCode::BUS_FAULT, physicalAddress.value());
+    return 0;
+  }
+
+  return instructionWord(memory->data() + physicalAddress.value());
+}
+
+const DecodedPage *CPU::decodePage(const uint32_t physicalPage){
+  if(physicalPage >= decodedPages.size()){
+    return nullptr;
+  }
+
+  auto &entry = decodedPages[physicalPage];
+
+  if(entry){
+    return entry.get();
+  }
+
+  // Partial pages at the end of memory are left to the slow path
+  const size_t base = static_cast<size_t>(physicalPage) << pageShift;
+  if(base + pageSize > memory->size()){
+    return nullptr;
+  }
+
+  entry = std::make_unique<DecodedPage>();
+
+  for(uint32_t i{0}; i < pageSize / 4; i++){
+    entry->insts[i] = decodeBinRegInst(instructionWord(memory->data() + base + i*4));
+  }
+  fusePairs(*entry);
+
+  return entry.get();
+}
+
+void CPU::invalidateDecoded(const uint32_t physicalAddress, const uint64_t nBytes){
+  const uint32_t first = physicalAddress >> pageShift;
+  const uint32_t last = (physicalAddress + nBytes - 1) >> pageShift;
+
+  for(uint32_t page{first}; page <= last && page < decodedPages.size(); page++){
+    if(!decodedPages[page]){
+      continue;
+    }
+
+    if(decodedPages[page].get() == fetchDecoded){
+      flushFetchTranslation();
+    }
+    // Handlers are given the Inst in place, keep it valid until they return
+    if(page == fetchPage){
+      runningDecoded = std::move(decodedPages[page]);
+    }
+    decodedPages[page].reset();
+
+    if(jit){
+      jit->invalidate();
+    }
+  }
+}
+
+void CPU::dropDecoded(void){
+  if(fetchPage < decodedPages.size() && decodedPages[fetchPage]){
+    runningDecoded = std::move(decodedPages[fetchPage]);
+  }
+  for(auto &page : decodedPages){
+    page.reset();
+  }
+  flushFetchTranslation();
+
+  if(jit){
+    jit->invalidate();
+  }
+}
+
+// Checked on every page crossing and slice, so the flag is read relaxed first
+void CPU::dropStaleDecoded(void){
+  if(codeStale.load(std::memory_order_relaxed) && codeStale.exchange(false)){
+    dropDecoded();
+  }
+}
+
+// Must be called whenever the virtual to physical mapping of ip may change
+void CPU::flushFetchTranslation(void){
+  fetchTag.store(UINT64_MAX, std::memory_order_relaxed);
+  fetchDecoded = nullptr;
+}
+
+// Like a hardware TLB, this is not coherent with page table writes, the
+// guest reloads RPT after editing its tables
+void CPU::flushTLB(void){
+  for(auto &entry : tlb){
+    entry.tag = TLB::INVALID_TAG;
+  }
+  flushFetchTranslation();
+
+  if(jit){
+    jit->invalidate();
+  }
+}
+
+// Slow path of mLoad and mStore, only reached past the end of memory
+[[gnu::cold]] bool CPU::busLoad(const uint32_t physicalAddress, const uint8_t nBytes, uint64_t &value){
+  if(const Bus::Region *region = bus->find(physicalAddress, nBytes)){
+    if(const auto read = region->device->read(*this, physicalAddress - region->base, nBytes)){
+      value = read.value();
+      return true;
+    }
+  }
+
+  raise(IntCode::BUS_FAULT, physicalAddress);
+  return false;
+}
+
+[[gnu::cold]] bool CPU::busStore(const uint32_t physicalAddress, const uint8_t nBytes, const uint64_t data){
+  if(const Bus::Region *region = bus->find(physicalAddress, nBytes)){
+    if(region->device->write(*this, physicalAddress - region->base, nBytes, data)){
+      return true;
+    }
+  }
+
+  raise(IntCode::BUS_FAULT, physicalAddress);
+  return false;
 }
 
-void CPU::dispatchInstruction(const uint32_t inst){
-  // Only one instruction form, upper 2 bits of opcode may be used to define others
-  Inst decoded = decodeBinRegInst(inst);
+// Every opcode and the family that executes it, in opcode order
+#define IDEALVM_OPS(X) \
+  X(MOV, executeMisc) X(GEF, executeMisc) \
+  X(LB, executeLoad) X(LBU, executeLoad) X(LH, executeLoad) X(LHU, executeLoad) \
+  X(LW, executeLoad) X(LWU, executeLoad) X(LD, executeLoad) \
+  X(SB, executeStore) X(SH, executeStore) X(SW, executeStore) X(SD, executeStore) \
+  X(PUSH, executeStack) X(POP, executeStack) \
+  X(JMP, executeConditional) X(JLT, executeConditional) X(JGT, executeConditional) \
+  X(JZR, executeConditional) X(JIF, executeConditional) \
+  X(AND, executeBinaryRegOp) X(OR, executeBinaryRegOp) X(XOR, executeBinaryRegOp) \
+  X(SHL, executeBinaryRegOp) X(SHR, executeBinaryRegOp) \
+  X(ADD, executeBinaryRegOp) X(SUB, executeBinaryRegOp) X(MUL, executeBinaryRegOp) \
+  X(SMUL, executeBinaryRegOp) X(DIV, executeBinaryRegOp) X(SDIV, executeBinaryRegOp) \
+  X(SSHR, executeBinaryRegOp) \
+  X(INT, executeMisc) \
+  X(PMOV, executePriviliged) X(IRET, executePriviliged) X(HLT, executePriviliged) \
+  X(BRK, executeMisc) \
+  X(CAS, executeAtomic) X(FADD, executeAtomic) \
+  X(PRD, executeMisc) \
+  X(MCPY, executeBulk) X(MSET, executeBulk) \
+  X(VLD, executeVector) X(VST, executeVector) \
+  X(VADD, executeVector) X(VSUB, executeVector) X(VAND, executeVector) \
+  X(VOR, executeVector) X(VXOR, executeVector) X(VSHL, executeVector) \
+  X(VSHR, executeVector) X(VCEQ, executeVector) X(VCGT, executeVector) \
+  X(VBRD, executeVector) X(VGET, executeVector)
+
+#define OP_VALUE(op, family) Op::op,
+constexpr Op opOrder[] = { IDEALVM_OPS(OP_VALUE) };
+#undef OP_VALUE
+
+// Computed goto tables are indexed directly by opcode, so the list must be dense
+static_assert([]{
+  for(size_t i{0}; i < std::size(opOrder); i++){
+    if(opOrder[i] != i)
+      return false;
+  }
+  return true;
+}(), "IDEALVM_OPS must list every opcode in order");
+
+// Adjacent pairs decodePage fuses into one dispatch: address formation,
+// pointer bumps, copies, counted loops and stack sequences. Both halves still
+// retire one at a time, so faults stay precise and budgets, traces and
+// profiles see two instructions.
+#define IDEALVM_FUSED(X) \
+  X(MOV, executeMisc, LD, executeLoad) X(MOV, executeMisc, LW, executeLoad) \
+  X(LD, executeLoad, SD, executeStore) \
+  X(ADD, executeBinaryRegOp, ADD, executeBinaryRegOp) \
+  X(ADD, executeBinaryRegOp, SUB, executeBinaryRegOp) \
+  X(ADD, executeBinaryRegOp, JMP, executeConditional) \
+  X(SUB, executeBinaryRegOp, JZR, executeConditional) \
+  X(SUB, executeBinaryRegOp, JLT, executeConditional) \
+  X(SUB, executeBinaryRegOp, JGT, executeConditional) \
+  X(AND, executeBinaryRegOp, JZR, executeConditional) \
+  X(PUSH, executeStack, PUSH, executeStack) X(POP, executeStack, POP, executeStack)
+
+// Fused opcodes follow the architectural ones so dispatch tables stay dense
+#define FUSED_VALUE(first, firstFamily, second, secondFamily) first##_##second,
+enum FusedOp : uint8_t {
+  FUSED_START = std::size(opOrder),
+  FUSED_BEFORE_FIRST = FUSED_START - 1,
+  IDEALVM_FUSED(FUSED_VALUE)
+  FUSED_END,
+};
+#undef FUSED_VALUE
+
+// Reserved opcodes decode to this so they cannot alias a fused one
+constexpr uint8_t invalidOpcode = 0xFF;
+static_assert(FUSED_END <= invalidOpcode);
+
+struct FusedPair {
+  uint8_t first;
+  uint8_t second;
+};
+
+#define FUSED_PAIR(first, firstFamily, second, secondFamily) {Op::first, Op::second},
+constexpr FusedPair fusedPairs[] = { IDEALVM_FUSED(FUSED_PAIR) };
+#undef FUSED_PAIR
+
+// Fused opcode of every (first, second) pair, 0 where the pair is not fused
+constexpr auto fusedOpcodes = []{
+  std::array<std::array<uint8_t, FUSED_START>, FUSED_START> table{};
+  for(uint8_t i{0}; i < std::size(fusedPairs); i++){
+    table[fusedPairs[i].first][fusedPairs[i].second] = FUSED_START + i;
+  }
+  return table;
+}();
+
+uint8_t unfusedOpcode(const uint8_t opcode){
+  if(opcode >= FUSED_START && opcode < FUSED_END){
+    return fusedPairs[opcode - FUSED_START].first;
+  }
+  return opcode;
+}
+
+// The second half of a pair keeps its own Inst, so jumps into it run it
+// alone and the JIT can ignore fusion. Pairs never straddle pages.
+static void fusePairs(DecodedPage &page){
+  for(uint32_t i{0}; i + 1 < pageSize / 4; i++){
+    const uint8_t first = page.insts[i].opcode;
+    const uint8_t second = page.insts[i + 1].opcode;
+
+    if(first < FUSED_START && second < FUSED_START && fusedOpcodes[first][second]){
+      page.insts[i].opcode = fusedOpcodes[first][second];
+    }
+  }
+}
+
+const char *opName(const uint8_t opcode){
+#define OP_NAME(op, family) #op,
+  static const char *const names[] = { IDEALVM_OPS(OP_NAME) };
+#undef OP_NAME
+
+  return opcode < std::size(names) ? names[opcode] : "INVALID";
+}
+
+// Decode strips lane widths and marks reserved opcodes, which fault
+const std::array<CPU::Handler, 256> CPU::handlers = []{
+  std::array<Handler, 256> table{};
+  table.fill(&CPU::executeInvalid);
+
+#define OP_HANDLER(op, family) table[Op::op] = &CPU::family<Op::op>;
+  IDEALVM_OPS(OP_HANDLER)
+#undef OP_HANDLER
+
+  // Single dispatch of a fused pair runs its first half, the second follows
+  // as an instruction of its own
+#define FUSED_HANDLER(first, firstFamily, second, secondFamily) \
+  table[FusedOp::first##_##second] = &CPU::firstFamily<Op::first>;
+  IDEALVM_FUSED(FUSED_HANDLER)
+#undef FUSED_HANDLER
+
+  return table;
+}();
+
+void CPU::dispatchInstruction(const Inst &decoded){
+#ifdef IDEALVM_COMPUTED_GOTO
+#define OP_LABEL(op, family) &&op_##op,
+  static const void *const labels[] = { IDEALVM_OPS(OP_LABEL) };
+#undef OP_LABEL
+
+  if(decoded.opcode >= std::size(labels)){
+    (this->*handlers[decoded.opcode])(decoded);
+    return;
+  }
+
+  goto *labels[decoded.opcode];
+
+#define OP_CASE(op, family) op_##op: family<Op::op>(decoded); return;
+  IDEALVM_OPS(OP_CASE)
+#undef OP_CASE
+#else
+  (this->*handlers[decoded.opcode])(decoded);
+#endif
+}
+
+// The timer is folded into the budget: slices end exactly on ticks, so the
+// loop itself never looks at it. Hardware interrupts are delivered between
+// slices, devices raising one end the slice early.
+StopReason CPU::run(const uint64_t budget){
+  if(doubleFaulted){
+    return StopReason::DOUBLE_FAULT;
+  }
+  if(halted && !canWake()){
+    return StopReason::HALT;
+  }
+
+  uint64_t left = budget;
+
+  while(left){
+    // Nothing else can happen while halted, so the rest of the interval
+    // passes at once
+    if(halted){
+      halted = false;
+      if(!irqPending){
+        irqPending = irqBit(IntCode::TIMER_CLOCK);
+        timerCountdown = st.protectedReg[TIMER];
+      }
+    }
+
+    dropStaleDecoded();
+
+    if(irqDeliverable()){
+      deliverIRQ();
+      if(doubleFaulted){
+        stopRequested = false;
+        return StopReason::DOUBLE_FAULT;
+      }
+    }
+
+    const uint64_t before = retired;
+    const StopReason reason = trace ? runSlice<true>(timerSlice(left)) : runSlice<false>(timerSlice(left));
+    const uint64_t executed = retired - before;
 
-  if (decoded.opcode >= Op::LB && decoded.opcode <= Op::LD){
-    executeLoad(decoded);
+    left -= executed;
+    advanceTimer(executed);
+
+    if(reason == StopReason::HALT && canWake()){
+      continue;
+    }
+    if(reason != StopReason::BUDGET_EXHAUSTED){
+      return reason;
+    }
   }
-  else if(decoded.opcode >= Op::SB && decoded.opcode <= Op::SD){
-    executeStore(decoded);
+
+  return StopReason::BUDGET_EXHAUSTED;
+}
+
+// Tracing gets its own instantiation so the untraced loop is left untouched
+template<bool traced>
+StopReason CPU::runSlice(const uint64_t budget){
+  // ip and the budget live in locals, st.ip is only synced for interrupts
+  uint64_t ip = st.ip;
+  uint64_t remaining = budget;
+  const Inst *inst{};
+  [[maybe_unused]] TraceRecord *record{};
+
+#define TRACE(statement) if constexpr(traced){ statement }
+
+#ifdef IDEALVM_COMPUTED_GOTO
+#define OP_LABEL(op, family) &&run_##op,
+#define FUSED_LABEL(first, firstFamily, second, secondFamily) &&run_##first##_##second,
+  static const void *const labels[] = { IDEALVM_OPS(OP_LABEL) IDEALVM_FUSED(FUSED_LABEL) };
+#undef FUSED_LABEL
+#undef OP_LABEL
+
+  // Replicated at the end of every handler so each opcode has its own branch
+#define DISPATCH() \
+  inst = fetchInst(ip); \
+  TRACE(record = &traceBegin(ip, *inst);) \
+  if(interruptPending) \
+    goto run_retire; \
+  PROFILE(countInstruction(ip, inst->opcode);) \
+  goto *(inst->opcode < std::size(labels) ? labels[inst->opcode] : &&run_invalid)
+
+  DISPATCH();
+
+  // retired only catches up once the slice ends, PRD is the one reader that
+  // cannot wait. Bulk ops need their own ip to run again.
+#define OP_CASE(op, family) \
+  run_##op: \
+    if constexpr(Op::op == Op::PRD){ \
+      sliceRetired = budget - remaining; \
+    } \
+    if constexpr(Op::op == Op::MCPY || Op::op == Op::MSET){ \
+      st.ip = ip; \
+    } \
+    family<Op::op>(*inst); \
+    TRACE(traceEnd(*record, *inst);) \
+    if(retire(ip, remaining)){ \
+      DISPATCH(); \
+    } \
+    goto run_stop;
+  IDEALVM_OPS(OP_CASE)
+#undef OP_CASE
+
+  // A faulting first half is retired alone. The second half is the next Inst
+  // of the page unless the first wrote to that page, which drops it.
+#define FUSED_CASE(first, firstFamily, second, secondFamily) \
+  run_##first##_##second: \
+    firstFamily<Op::first>(*inst); \
+    if(interruptPending) \
+      goto run_retire; \
+    TRACE(traceEnd(*record, *inst);) \
+    if(!retire(ip, remaining)) \
+      goto run_stop; \
+    if(!fetchDecoded){ \
+      DISPATCH(); \
+    } \
+    inst++; \
+    TRACE(record = &traceBegin(ip, *inst);) \
+    PROFILE(countInstruction(ip, Op::second);) \
+    secondFamily<Op::second>(*inst); \
+    TRACE(traceEnd(*record, *inst);) \
+    if(retire(ip, remaining)){ \
+      DISPATCH(); \
+    } \
+    goto run_stop;
+  IDEALVM_FUSED(FUSED_CASE)
+#undef FUSED_CASE
+
+run_invalid:
+  executeInvalid(*inst);
+run_retire:
+  TRACE(traceEnd(*record, *inst);)
+  if(retire(ip, remaining)){
+    DISPATCH();
   }
-  else if(decoded.opcode >= Op::AND && decoded.opcode <= Op::SSHR){
-    executeBinaryRegOp(decoded);
-  } 
-  else if(decoded.opcode >= Op::JMP && decoded.opcode <= Op::JIF){
-    executeConditional(decoded);
+#undef DISPATCH
+
+run_stop:
+#else
+  do{
+    inst = fetchInst(ip);
+    TRACE(record = &traceBegin(ip, *inst);)
+    if(!interruptPending){
+      PROFILE(countInstruction(ip, inst->opcode);)
+      if(inst->opcode == Op::PRD){
+        sliceRetired = budget - remaining;
+      }
+      if(inst->opcode == Op::MCPY || inst->opcode == Op::MSET){
+        st.ip = ip;
+      }
+      dispatchInstruction(*inst);
+    }
+    TRACE(traceEnd(*record, *inst);)
+  } while(retire(ip, remaining));
+#endif
+#undef TRACE
+
+  st.ip = ip;
+  retired += budget - remaining;
+  materializeFlags(); // Callers may inspect st between runs
+
+  if(stopRequested){
+    stopRequested = false;
+    return stopReason;
   }
-  else if(decoded.opcode >= Op::PMOV && decoded.opcode <= Op::IRET){
-    executePriviliged(decoded);
+
+  return StopReason::BUDGET_EXHAUSTED;
+}
+
+// Common tail of every instruction, false once run has to stop
+IDEALVM_ALWAYS_INLINE bool CPU::retire(uint64_t &ip, uint64_t &remaining){
+  if(interruptPending){
+    st.ip = ip;
+    deliverPendingInterrupt();
   }
-  else if (decoded.opcode <= Op::PMOV){
-    executeMisc(decoded);
+
+  if(nipSet){
+    nipSet = false;
+    ip = nip;
   }
   else{
-    throw Interrupt(IntCode::INSTRUCTION_FAULT, 0x0);
+    ip += 4;
+  }
+
+  st.registers[Reg::Z] = 0;
+  return --remaining != 0 && !stopRequested;
+}
+
+// A fetch fault leaves inst zeroed, the flag tells it from a real opcode 0
+IDEALVM_ALWAYS_INLINE TraceRecord &CPU::traceBegin(const uint64_t ip, const Inst &inst){
+  TraceRecord &record = trace->next();
+  record.ip = ip;
+  record.operand = st.registers[inst.r1] + inst.offset;
+  record.inst = (uint32_t{unfusedOpcode(inst.opcode)} | uint32_t{inst.width} << LANE_WIDTH_SHIFT) << 24 |
+                uint32_t{inst.r0} << 20 | uint32_t{inst.r1} << 16 |
+                static_cast<uint16_t>(inst.offset);
+  record.flags = interruptPending ? TraceFlag::FETCH_FAULT : 0;
+  record.code = 0;
+  return record;
+}
+
+IDEALVM_ALWAYS_INLINE void CPU::traceEnd(TraceRecord &record, const Inst &inst){
+  record.result = st.registers[inst.r0];
+  if(interruptPending){
+    record.flags |= TraceFlag::RAISED;
+    record.code = pendingInterrupt.code;
+  }
+  trace->publish();
+}
+
+#ifdef IDEALVM_PROFILE
+void CPU::countInstruction(const uint64_t ip, const uint8_t opcode){
+  profile.opcodes[unfusedOpcode(opcode)]++;
+  profile.addresses[ip]++;
+}
+#endif
+
+void CPU::deliverPendingInterrupt(void){
+  interruptPending = false;
+
+  // Faults retry the instruction, everything else resumes after it
+  const uint64_t rip = pendingInterrupt.code > IntCode::FAULT_END ? st.ip + 4 : st.ip;
+  handleInterrupt(pendingInterrupt, rip);
+}
+
+uint64_t CPU::timerSlice(const uint64_t budget) const{
+  return timerCountdown ? std::min(budget, timerCountdown) : budget;
+}
+
+// Slices never run past the next tick, so the countdown cannot wrap
+void CPU::advanceTimer(const uint64_t executed){
+  if(timerCountdown && (timerCountdown -= executed) == 0){
+    irqPending |= irqBit(IntCode::TIMER_CLOCK);
+    timerCountdown = st.protectedReg[TIMER];
+  }
+
+  // Writing TIMER ends the slice, so the new interval starts counting here
+  if(timerRearm){
+    timerRearm = false;
+    timerCountdown = st.protectedReg[TIMER];
+  }
+}
+
+// Held until interrupts are enabled, the instruction raising it still retires
+void CPU::raiseIRQ(const IntCode code){
+  irqPending |= irqBit(code);
+  yieldSlice();
+}
+
+bool CPU::irqDeliverable(void) const{
+  return irqPending && (st.protectedReg[EFLAGS] & EF::INTERRUPT_ENABLE) && !handlingInterrupt;
+}
+
+bool CPU::canWake(void) const{
+  return (irqPending || timerCountdown) && (st.protectedReg[EFLAGS] & EF::INTERRUPT_ENABLE) &&
+         !handlingInterrupt;
+}
+
+// Lowest code first. Between instructions, st.ip has not executed yet and is
+// where the guest resumes.
+void CPU::deliverIRQ(void){
+  const auto n = std::countr_zero(irqPending);
+  irqPending &= irqPending - 1;
+  handleInterrupt(Interrupt(static_cast<IntCode>(IntCode::HW_INTERRUPT_START + n), 0), st.ip);
+
+  if(nipSet){
+    nipSet = false;
+    st.ip = nip;
+  }
+}
+
+// Restarts the countdown from the next instruction on
+void CPU::writeTimer(const uint64_t interval){
+  st.protectedReg[TIMER] = interval;
+  timerRearm = true;
+  yieldSlice();
+}
+
+// Ends the current slice once the instruction retires, so run can act on
+// timer or interrupt state the instruction changed
+void CPU::yieldSlice(void){
+  if(!stopRequested){
+    requestStop(StopReason::BUDGET_EXHAUSTED);
   }
 }
 
+void CPU::executeInvalid(const Inst &){
+  raise(IntCode::INSTRUCTION_FAULT, 0x0);
+}
+
+template<Op op>
 void CPU::executePriviliged(const Inst &inst){
   if(st.protectedReg[EFLAGS] & EF::PROTECTED_ENABLE){
-    throw Interrupt(IntCode::INSTRUCTION_FAULT, 0x3);
+    raise(IntCode::INSTRUCTION_FAULT, 0x3);
+    return;
   }
 
-  if(inst.opcode == Op::PMOV){
+  if constexpr(op == Op::PMOV){
+    if(inst.r0 >= RETIRED && inst.r0 <= INTERRUPTS){
+      raise(IntCode::INSTRUCTION_FAULT, 0x3);
+      return;
+    }
+    if(inst.r0 == EFLAGS){
+      materializeFlags();
+    }
     st.protectedReg[inst.r0] = st.registers[inst.r1] + inst.offset;
+    if(inst.r0 == TIMER){
+      writeTimer(st.protectedReg[TIMER]);
+    }
+    // Enabling interrupts may have to deliver held back ones
+    if(inst.r0 == EFLAGS && irqPending){
+      yieldSlice();
+    }
+    if(inst.r0 == EFLAGS || inst.r0 == RPT){
+      // Also where code written by other harts becomes visible
+      if(sharedMemory){
+        dropDecoded();
+      }
+      flushTLB();
+    }
   }
-  else if(inst.opcode == Op::IRET){
-    const uint64_t eflags = stackPop();
-    const uint64_t rip = stackPop();
+  else if constexpr(op == Op::IRET){
+    const auto eflags = mLoad<8>(st.registers[SP]);
+    const auto rip = mLoad<8>(st.registers[SP] + 8);
+
+    if(!eflags || !rip){
+      return;
+    }
+
+    st.registers[SP] += 16;
 
     nipSet = true;
-    nip = rip;
+    nip = rip.value();
 
     st.protectedReg[PSP] = st.registers[SP];
     st.registers[SP] = st.protectedReg[USP];
 
-    st.protectedReg[EFLAGS] = eflags;
+    // Turning paging on or off drops translations like PMOV does. Protection
+    // is restored on every return and translations are tagged with it.
+    const bool pagingChanged = (st.protectedReg[EFLAGS] ^ eflags.value()) & EF::PAGING_ENABLE;
+    flagsLazy = false;
+    st.protectedReg[EFLAGS] = eflags.value();
     st.protectedReg[EFLAGS] |= EF::PROTECTED_ENABLE | EF::INTERRUPT_ENABLE;
+    if(pagingChanged){
+      flushTLB();
+    }
+    else{
+      flushFetchTranslation();
+    }
 
     handlingInterrupt = false;
+    if(irqPending){
+      yieldSlice();
+    }
+  }
+  else if constexpr(op == Op::HLT){
+    halted = true;
+    requestStop(StopReason::HALT);
   }
 }
 
+// Single operand instructions encode their register in r1
+template<Op op>
 void CPU::executeMisc(const Inst &inst){
-  if(inst.opcode == Op::MOV){
+  if constexpr(op == Op::MOV){
     st.registers[inst.r0] = st.registers[inst.r1]+inst.offset;
   }
-  else if(inst.opcode == Op::GEF){
-    st.registers[inst.r0] = st.protectedReg[EFLAGS];
+  else if constexpr(op == Op::GEF){
+    materializeFlags();
+    st.registers[inst.r1] = st.protectedReg[EFLAGS];
   }
-  else if(inst.opcode == Op::INT){
+  else if constexpr(op == Op::INT){
     uint64_t code = st.registers[inst.r1]+inst.offset;
     if(code < IntCode::SOFTWARE_INTERUPT_START || code > SOFTWARE_INTERUPT_END)
-      throw Interrupt(IntCode::INSTRUCTION_FAULT, 0x03);
-    throw Interrupt(static_cast<IntCode>(code), 0x0);
+      raise(IntCode::INSTRUCTION_FAULT, 0x03);
+    else
+      raise(static_cast<IntCode>(code), 0x0);
+  }
+  else if constexpr(op == Op::BRK){
+    requestStop(StopReason::BREAKPOINT);
+  }
+  else if constexpr(op == Op::PRD){
+    const bool counter = inst.r1 >= RETIRED && inst.r1 <= INTERRUPTS;
+    const uint64_t eflags = st.protectedReg[EFLAGS];
+
+    if((eflags & EF::PROTECTED_ENABLE) && !(counter && (eflags & EF::COUNTER_ACCESS))){
+      raise(IntCode::INSTRUCTION_FAULT, 0x3);
+      return;
+    }
+
+    switch(inst.r1){
+      case RETIRED:
+        st.registers[inst.r0] = retired + sliceRetired;
+        break;
+      case PAGE_FAULTS:
+        st.registers[inst.r0] = pageFaults;
+        break;
+      case TLB_MISSES:
+        st.registers[inst.r0] = pageWalks;
+        break;
+      case INTERRUPTS:
+        st.registers[inst.r0] = interruptsTaken;
+        break;
+      case EFLAGS:
+        materializeFlags();
+        [[fallthrough]];
+      default:
+        st.registers[inst.r0] = st.protectedReg[inst.r1];
+    }
   }
 }
 
-void CPU::executeLoad(const Inst &inst){
+// Sequentially consistent on the host, so CAS and FADD also order the
+// plain accesses around them
+template<Op op>
+void CPU::executeAtomic(const Inst &inst){
   const uint32_t logicalAddress = st.registers[inst.r1] + inst.offset;
-  const uint32_t physicalAddress = resolveAddress(logicalAddress);
-  uint64_t result{};
 
-  auto signExtend = [] (const uint64_t val, const uint8_t nBytes) -> uint64_t {
-    const bool sign = static_cast<int64_t>(val) < 0;
-    uint64_t ret = val;
-    if(sign){
-      ret |= UINT64_MAX << 8*nBytes;
+  if(logicalAddress % 8){
+    raise(IntCode::ALIGNMENT_FAULT, logicalAddress);
+    return;
+  }
+
+  // Needs write permission even if the compare fails
+  const auto translated = resolveAddress(logicalAddress, true);
+
+  if(!translated){
+    return;
+  }
+
+  const uint32_t physicalAddress = translated.value();
+
+  if(physicalAddress + 8ull > memory->size()){
+    raise(IntCode::BUS_FAULT, physicalAddress);
+    return;
+  }
+
+  invalidateIfDecoded(physicalAddress, 8);
+
+  // Memory is little-endian, swap around the host atomic on big-endian hosts
+  auto toHost = [](const uint64_t value){
+    if constexpr(std::endian::native == std::endian::big){
+      return std::byteswap(value);
     }
-    return ret;
+    return value;
   };
 
-  uint8_t nBytes{};
-  bool hasSign{(inst.opcode - Op::LB) % 2 == 1};
+  std::atomic_ref word(*reinterpret_cast<uint64_t *>(memory->data() + physicalAddress));
+
+  if constexpr(op == Op::CAS){
+    const uint64_t compare = st.registers[Reg::A];
+    uint64_t old = toHost(compare);
+    word.compare_exchange_strong(old, toHost(st.registers[inst.r0]), std::memory_order_seq_cst);
+    old = toHost(old);
 
-  if(inst.opcode <= Op::LBU)
-    nBytes = 1;
-  else if(inst.opcode <= Op::LHU)
-    nBytes = 2;
-  else if(inst.opcode <= Op::LWU)
-    nBytes = 4;
-  else
-    nBytes = 8;
+    // Zero is set exactly when the swap happened
+    flagsLazy = true;
+    flagsOp = Op::SUB;
+    flagsO1 = old;
+    flagsO2 = compare;
+    flagsResult = old - compare;
 
-  if(hasSign){
-    result = signExtend(mLoad(physicalAddress,nBytes), nBytes);
+    st.registers[Reg::A] = old;
   }
-  else{
-    result = mLoad(physicalAddress, nBytes);
+  else if constexpr(op == Op::FADD){
+    uint64_t old{};
+    if constexpr(std::endian::native == std::endian::little){
+      old = word.fetch_add(st.registers[inst.r0], std::memory_order_seq_cst);
+    }
+    else{
+      uint64_t expected = word.load(std::memory_order_relaxed);
+      while(!word.compare_exchange_weak(expected, toHost(toHost(expected) + st.registers[inst.r0]),
+                                        std::memory_order_seq_cst)){
+      }
+      old = toHost(expected);
+    }
+
+    st.registers[inst.r0] = old;
   }
+}
 
-  st.registers[inst.r0] = result;
+// Restartable: the registers always hold what is left to do, so a fault part
+// way through leaves them at the first byte not done and the retried
+// instruction carries on from there. Work is split at page boundaries of
+// both ranges, each piece is one host memmove or memset. Overlapping copies
+// to a higher address run from the end, so MCPY behaves like memmove.
+template<Op op>
+void CPU::executeBulk(const Inst &inst){
+  const uint8_t lengthReg = inst.offset & 0xF;
+  uint64_t dst = st.registers[inst.r0];
+  uint64_t src = st.registers[inst.r1];
+  uint64_t length = st.registers[lengthReg];
+
+  const bool paged = st.protectedReg[EFLAGS] & EF::PAGING_ENABLE;
+  const bool backward = op == Op::MCPY && dst > src && dst - src < length;
+
+  // Bytes from address to the end of its page, or of the address space
+  auto ahead = [paged](const uint32_t address) -> uint64_t {
+    return paged ? pageSize - (address & (pageSize - 1)) : (uint64_t{1} << 32) - address;
+  };
+  // Bytes up to and including address from the start of its page
+  auto behind = [paged](const uint32_t address) -> uint64_t {
+    return paged ? (address & (pageSize - 1)) + 1 : uint64_t{address} + 1;
+  };
+
+  uint64_t chunk = bulkChunk;
+
+  while(length && chunk){
+    uint64_t n{};
+    uint64_t offset{};
+
+    if(backward){
+      n = std::min({length, chunk, behind(dst + length - 1), behind(src + length - 1)});
+      offset = length - n;
+    }
+    else{
+      n = std::min({length, chunk, ahead(dst)});
+      if constexpr(op == Op::MCPY){
+        n = std::min(n, ahead(src));
+      }
+    }
+
+    std::optional<uint32_t> from{};
+    if constexpr(op == Op::MCPY){
+      from = resolveAddress(src + offset);
+      if(!from){
+        break;
+      }
+    }
+
+    const auto to = resolveAddress(dst + offset, true);
+    if(!to){
+      break;
+    }
+
+    uint64_t done{};
+    if constexpr(op == Op::MCPY){
+      done = bulkCopy(to.value(), from.value(), n, backward);
+    }
+    else{
+      done = bulkFill(to.value(), static_cast<uint8_t>(st.registers[inst.r1]), n);
+    }
+
+    length -= done;
+    chunk -= done;
+    if(!backward){
+      dst += done;
+      src += done;
+    }
+    if(done != n){
+      break;
+    }
+  }
+
+  st.registers[inst.r0] = dst;
+  if constexpr(op == Op::MCPY){
+    st.registers[inst.r1] = src;
+  }
+  st.registers[lengthReg] = length;
+
+  // The rest is left to the next execution, so one instruction never holds
+  // off the timer or the budget for long
+  if(length && !interruptPending){
+    nipSet = true;
+    nip = st.ip;
+  }
 }
 
-void CPU::executeStore(const Inst &inst){
+// Ranges partly outside memory go a byte at a time through the bus. Returns
+// the bytes moved, fewer than n only if a bus access raised.
+uint64_t CPU::bulkCopy(const uint32_t to, const uint32_t from, const uint64_t n, const bool backward){
+  if(to + n <= memory->size() && from + n <= memory->size()){
+    invalidateDecoded(to, n);
+    std::memmove(memory->data() + to, memory->data() + from, n);
+    return n;
+  }
+
+  for(uint64_t i{0}; i < n; i++){
+    const uint64_t at = backward ? n - 1 - i : i;
+    const auto byte = mLoad<1>(from + at);
+    // Either way the bytes done are the ones the length no longer covers
+    if(!byte || !mStore<1>(to + at, byte.value())){
+      return i;
+    }
+  }
+  return n;
+}
+
+uint64_t CPU::bulkFill(const uint32_t to, const uint8_t value, const uint64_t n){
+  if(to + n <= memory->size()){
+    invalidateDecoded(to, n);
+    std::memset(memory->data() + to, value, n);
+    return n;
+  }
+
+  for(uint64_t i{0}; i < n; i++){
+    if(!mStore<1>(to + i, value)){
+      return i;
+    }
+  }
+  return n;
+}
+
+// Lanewise ops run on the host kernels chosen at startup, see vector.hpp
+template<Op op>
+constexpr LaneOp laneOp(void){
+  if constexpr(op == Op::VADD) return LaneOp::ADD;
+  if constexpr(op == Op::VSUB) return LaneOp::SUB;
+  if constexpr(op == Op::VAND) return LaneOp::AND;
+  if constexpr(op == Op::VOR) return LaneOp::OR;
+  if constexpr(op == Op::VXOR) return LaneOp::XOR;
+  if constexpr(op == Op::VSHL) return LaneOp::SHL;
+  if constexpr(op == Op::VSHR) return LaneOp::SHR;
+  if constexpr(op == Op::VCEQ) return LaneOp::CEQ;
+  return LaneOp::CGT;
+}
+
+// VLD and VST move one aligned block, so a single translation covers it.
+// Vector registers do not reach devices, and their accesses are not atomic.
+template<Op op>
+void CPU::executeVector(const Inst &inst){
+  if constexpr(op == Op::VLD || op == Op::VST){
+    const uint32_t logicalAddress = st.registers[inst.r1] + inst.offset;
+
+    if(logicalAddress % sizeof(Vector)){
+      raise(IntCode::ALIGNMENT_FAULT, logicalAddress);
+      return;
+    }
+
+    const auto translated = resolveAddress(logicalAddress, op == Op::VST);
+
+    if(!translated){
+      return;
+    }
+
+    const uint32_t physicalAddress = translated.value();
+
+    if(physicalAddress + uint64_t{sizeof(Vector)} > memory->size()){
+      raise(IntCode::BUS_FAULT, physicalAddress);
+      return;
+    }
+
+    if constexpr(op == Op::VLD){
+      std::memcpy(st.vectors[inst.r0].bytes, memory->data() + physicalAddress, sizeof(Vector));
+    }
+    else{
+      invalidateIfDecoded(physicalAddress, sizeof(Vector));
+      std::memcpy(memory->data() + physicalAddress, st.vectors[inst.r0].bytes, sizeof(Vector));
+    }
+  }
+  else if constexpr(op == Op::VBRD){
+    broadcastLane(st.vectors[inst.r0], inst.width, st.registers[inst.r1] + inst.offset);
+  }
+  else if constexpr(op == Op::VGET){
+    const uint32_t lane = static_cast<uint16_t>(inst.offset) & ((sizeof(Vector) >> inst.width) - 1);
+    st.registers[inst.r0] = vectorLane(st.vectors[inst.r1], inst.width, lane);
+  }
+  else{
+    hostLaneKernels[static_cast<size_t>(laneOp<op>())][inst.width](
+        st.vectors[inst.r0], st.vectors[inst.r1], static_cast<uint64_t>(int64_t{inst.offset}));
+  }
+}
+
+template<Op op>
+void CPU::executeLoad(const Inst &inst){
   const uint32_t logicalAddress = st.registers[inst.r1] + inst.offset;
-  const uint32_t physicalAddress = resolveAddress(logicalAddress);
+  const auto translated = resolveAddress(logicalAddress);
 
-  if(inst.opcode == Op::SB){
-    mStore(physicalAddress, st.registers[inst.r0], 1);
+  if(!translated){
+    return;
   }
-  else if(inst.opcode == Op::SH){
-    mStore(physicalAddress, st.registers[inst.r0], 2);
+
+  const uint32_t physicalAddress = translated.value();
+
+  constexpr uint8_t nBytes = (op <= Op::LBU) ? 1 : (op <= Op::LHU) ? 2 : (op <= Op::LWU) ? 4 : 8;
+  constexpr bool hasSign = (op == Op::LB || op == Op::LH || op == Op::LW);
+
+  const auto loaded = mLoad<nBytes>(physicalAddress);
+
+  if(!loaded){
+    return;
   }
-  else if(inst.opcode == Op::SW){
-    mStore(physicalAddress, st.registers[inst.r0], 4);
+
+  uint64_t result = loaded.value();
+
+  if constexpr(hasSign){
+    constexpr unsigned unusedBits = 64 - 8*nBytes;
+    result = static_cast<uint64_t>(static_cast<int64_t>(result << unusedBits) >> unusedBits);
   }
-  else if(inst.opcode == Op::SD){
-    mStore(physicalAddress, st.registers[inst.r0], 8);
+
+  st.registers[inst.r0] = result;
+}
+
+template<Op op>
+void CPU::executeStore(const Inst &inst){
+  const uint32_t logicalAddress = st.registers[inst.r1] + inst.offset;
+  const auto translated = resolveAddress(logicalAddress, true);
+
+  if(!translated){
+    return;
   }
+
+  const uint32_t physicalAddress = translated.value();
+
+  constexpr uint8_t nBytes = (op == Op::SB) ? 1 : (op == Op::SH) ? 2 : (op == Op::SW) ? 4 : 8;
+
+  mStore<nBytes>(physicalAddress, st.registers[inst.r0]);
 }
 
+template<Op op>
 void CPU::executeStack(const Inst &inst){
-  if(inst.opcode == Op::PUSH){
+  if constexpr(op == Op::PUSH){
     stackPush(st.registers[inst.r1] + inst.offset);
   }
-  else if(inst.opcode == Op::POP){
-    st.registers[inst.r0] = stackPop();
+  else if constexpr(op == Op::POP){
+    const auto value = stackPop();
+    if(value){
+      st.registers[inst.r1] = value.value();
+    }
   }
 }
 
-void CPU::stackPush(const uint64_t value){
-  st.registers[Reg::SP] -= 8;
-  mStore(st.registers[Reg::SP], value, 8);
+// SP is only moved once the access has succeeded
+bool CPU::stackPush(const uint64_t value){
+  const uint64_t sp = st.registers[Reg::SP] - 8;
+  if(!mStore<8>(sp, value)){
+    return false;
+  }
+  st.registers[Reg::SP] = sp;
+  return true;
 }
 
-uint64_t CPU::stackPop(void){
-  uint64_t ret = mLoad(st.registers[Reg::SP], 8);
-  st.registers[Reg::SP] += 8;
+std::optional<uint64_t> CPU::stackPop(void){
+  const auto ret = mLoad<8>(st.registers[Reg::SP]);
+  if(ret){
+    st.registers[Reg::SP] += 8;
+  }
   return ret;
 }
 
+template<Op op>
 void CPU::executeConditional(const Inst &inst){
   nip = st.registers[inst.r1] + inst.offset;
-  const bool negative = st.protectedReg[EFLAGS] & EF::NEGATIVE;
-  const bool zero = st.protectedReg[EFLAGS] & EF::ZERO;
 
-  switch(inst.opcode){
-    case(Op::JMP):
-      nipSet = true;  
-      break;
-    case(Op::JGT):
-      nipSet = !(zero || negative);
-      break;
-    case(Op::JLT):
-      nipSet = negative; 
-      break;
-    case(Op::JZR):
-      nipSet = zero;
-      break;
-    case(Op::JIF):
-      nipSet = st.registers[inst.r0];
-      break;
-    }
+  if constexpr(op == Op::JMP){
+    nipSet = true;  
+  }
+  else if constexpr(op == Op::JGT){
+    nipSet = !(branchFlags() & (EF::ZERO | EF::NEGATIVE));
+  }
+  else if constexpr(op == Op::JLT){
+    nipSet = branchFlags() & EF::NEGATIVE; 
+  }
+  else if constexpr(op == Op::JZR){
+    nipSet = branchFlags() & EF::ZERO;
+  }
+  else if constexpr(op == Op::JIF){
+    nipSet = st.registers[inst.r0];
+  }
 }
 
+template<Op op>
 void CPU::executeBinaryRegOp(const Inst &inst){
   uint64_t result{};
   const uint64_t o1{st.registers[inst.r0]};
@@ -249,78 +1265,94 @@ void CPU::executeBinaryRegOp(const Inst &inst){
   const auto so1 = static_cast<int64_t>(o1);
   const auto so2 = static_cast<int64_t>(o2);
 
-  st.protectedReg[EFLAGS] &= (EF::CARRY | EF::OVERFLOW);
+  if constexpr(op == Op::ADD){
+    result = o1 + o2;
+  }
+  else if constexpr(op == Op::SUB){
+    result = o1 - o2;
+  }
+  else if constexpr(op == Op::MUL){
+    result = o1 * o2;
+  }
+  else if constexpr(op == Op::SMUL){
+    result = static_cast<uint64_t>(so1) * static_cast<uint64_t>(so2);
+  }
+  else if constexpr(op == Op::DIV){
+    if(o2 == 0){
+      clearArithmeticFlags();
+      raise(ALU_FAULT, 0x0);
+      return;
+    }
+    result = o1 / o2;
+    st.registers[inst.r1] = o1 % o2;      
+  }
+  else if constexpr(op == Op::SDIV){
+    // INT64_MIN / -1 is not representable
+    if(o2 == 0 || (so1 == INT64_MIN && so2 == -1)){
+      clearArithmeticFlags();
+      raise(ALU_FAULT, 0x0);
+      return;
+    }
+    result = static_cast<uint64_t>(so1/so2);
+    st.registers[inst.r1] = static_cast<uint64_t>(so1%so2);
+  }
+  else if constexpr(op == Op::SSHR){
+    result = static_cast<uint64_t>(so1 >> std::min<uint64_t>(o2, 63));
+  }
+  else if constexpr(op == Op::AND){
+    result = o1 & o2;
+  }
+  else if constexpr(op == Op::OR){
+    result = o1 | o2;
+  }
+  else if constexpr(op == Op::XOR){
+    result = o1 ^ o2;
+  }
+  else if constexpr(op == Op::SHL){
+    result = o2 < 64 ? o1 << o2 : 0;
+  }
+  else if constexpr(op == Op::SHR){
+    result = o2 < 64 ? o1 >> o2 : 0;
+  }
 
-  switch(inst.opcode){
-    case(Op::ADD):
-      result = o1 + o2;
-      if(didOverflow(o1, o2, result)){
-        st.protectedReg[EFLAGS] |= EF::OVERFLOW;
-      } 
-      if(result < o1){
-        st.protectedReg[EFLAGS] |= EF::CARRY;
-      }
-      break;
-    case(Op::SUB):
-      result = o1 - o2;
-      if(didOverflow(o1, o2, result)){
-        st.protectedReg[EFLAGS] |= EF::OVERFLOW;
-      }  
-      if(o2 > o1){
-        st.protectedReg[EFLAGS] |= EF::CARRY; // Carry = 1 if we needed to borrow (x86 behaviour)
-      }
-      break;
-    case(Op::MUL):
-      result = o1 * o2;
-      break;
-    case(Op::SMUL):
-      result = static_cast<uint64_t>(so1*so2);
-      break;
-    case(Op::DIV):
-      if(o2 == 0){
-        throw Interrupt(ALU_FAULT, 0x0);
-      }
-      result = o1 / o2;
-      st.registers[inst.r1] = o1 % o2;      
-      break; 
-    case(Op::SDIV):
-      if(o2 == 0){
-        throw Interrupt(ALU_FAULT, 0x0);
-      }
-      result = static_cast<uint64_t>(so1/so2);
-      st.registers[inst.r1] = static_cast<uint64_t>(so1%so2);
-      break;
-    case(Op::SSHR):
-      if(o1 & msbMask)
-        result = (o1 >> o2) | (UINT64_MAX << std::max<uint64_t>(64, 64-o2));
-      else
-        result = o1 >> o2;
-      break;
-    case(Op::AND):
-      result = o1 & o2;
-      break;
-    case(Op::OR):
-      result = o1 | o2;
-      break;
-    case(Op::XOR):
-      result = o1 ^ o2;
-      break;
-    case(Op::SHL):
-      result = o1 << o2;
-      break;
-    case(Op::SHR):
-      result = o1 >> o2;
-      break;
+  // Flags are derived from these only once something reads them
+  flagsLazy = true;
+  flagsOp = op;
+  flagsResult = result;
+  if constexpr(op == Op::ADD || op == Op::SUB){
+    flagsO1 = o1;
+    flagsO2 = o2;
   }
 
-  if(result == 0){
-    st.protectedReg[EFLAGS] |= EF::ZERO;
+  st.registers[inst.r0] = result;
+}
+
+// Folds the last ALU op into EFLAGS, needed before anything but a branch reads it
+void CPU::materializeFlags(void){
+  if(!flagsLazy){
+    return;
   }
-  if(result & msbMask){
-    st.protectedReg[EFLAGS] |= EF::NEGATIVE;
+
+  uint64_t flags{branchFlags()};
+  flagsLazy = false;
+
+  if(flagsOp == Op::ADD || flagsOp == Op::SUB){
+    if(didOverflow(flagsO1, flagsO2, flagsResult)){
+      flags |= EF::OVERFLOW;
+    }
+    if(flagsOp == Op::ADD ? flagsResult < flagsO1 : flagsO2 > flagsO1){
+      flags |= EF::CARRY; // Carry = 1 if we needed to borrow (x86 behaviour)
+    }
   }
 
-  st.registers[inst.r0] = result;
+  st.protectedReg[EFLAGS] &= ~(EF::CARRY | EF::OVERFLOW | EF::ZERO | EF::NEGATIVE);
+  st.protectedReg[EFLAGS] |= flags;
+}
+
+// Faulting divisions clear the flags before raising
+void CPU::clearArithmeticFlags(void){
+  flagsLazy = false;
+  st.protectedReg[EFLAGS] &= ~(EF::CARRY | EF::OVERFLOW | EF::ZERO | EF::NEGATIVE);
 }
 
 bool CPU::didOverflow(const uint64_t a, const uint64_t b,
@@ -335,35 +1367,34 @@ bool CPU::didOverflow(const uint64_t a, const uint64_t b,
   return false;
 }
 
-uint64_t CPU::mLoad(const uint32_t physicalAddress, const uint8_t nBytes){
-  uint64_t ret{};
+std::optional<uint32_t> CPU::resolveAddress(const uint32_t address, const bool write, const bool jump){
+  if(!(st.protectedReg[EFLAGS] & EF::PAGING_ENABLE)){
+    return address;
+  }
 
-  for(int i{nBytes-1}; i >= 0; i--){
-    ret |= memory[physicalAddress+i];
-    ret <<= 8;
+  uint32_t tag = address >> pageShift;
+  if(st.protectedReg[EFLAGS] & EF::PROTECTED_ENABLE){
+    tag |= TLB::PROTECTED_TAG;
   }
 
-  return ret;
-}
+  const uint8_t needed = write ? TLB::WRITE : (jump ? TLB::EXEC : TLB::READ);
+  const TLBEntry &entry = tlb[tag % tlbEntries];
+
+  if(entry.tag == tag && (entry.perms & needed)){
+    return entry.frame | (address & (pageSize - 1));
+  }
 
-void CPU::mStore(const uint32_t physicalAddress, uint64_t data,
-                 const uint8_t nBytes){
-  for(int i{0}; i < nBytes; i++){
-    memory[physicalAddress+i] = static_cast<uint8_t>(data);
-    data >>= 8;
-  } 
+  return walkPageTable(address, write, jump);
 }
 
-uint32_t CPU::resolveAddress(const uint32_t address, const bool write, const bool jump){
-  if(!(st.protectedReg[EFLAGS] & EF::PAGING_ENABLE)){
-    return address;
-  }
+std::optional<uint32_t> CPU::walkPageTable(const uint32_t address, const bool write, const bool jump){
+  pageWalks++;
 
   const uint16_t rootIndex = (address & 0xFFC00000) >> 22;
   const uint16_t pageIndex = (address & 0x3FF000) >> 12;
   const uint16_t offset = address & 0xFFF;
 
-  auto getPageMap = [&] (const uint32_t entry) -> uint32_t {
+  auto getPageMap = [&] (const uint32_t entry) -> std::optional<uint32_t> {
     uint64_t errorType{};
 
     if(!(entry & PE::OCCUPIED)){ // Page is not mapped or not present
@@ -382,24 +1413,68 @@ uint32_t CPU::resolveAddress(const uint32_t address, const bool write, const boo
 
     // Failing bit is used as the error code stored in upper 32 bits
     if(errorType){
-      throw Interrupt(IntCode::PAGE_FAULT, (address & 0xFFFFFFFF) | (errorType << 32));
+      raise(IntCode::PAGE_FAULT, (address & 0xFFFFFFFF) | (errorType << 32));
+      return std::nullopt;
     }
 
     return entry & PE::FRAME;
   };
 
-  uint32_t rootEntry = static_cast<uint32_t>(mLoad(st.protectedReg[RPT]+rootIndex, 4));
-  const uint32_t pageTable = getPageMap(rootEntry);
-  uint32_t tableEntry = static_cast<uint32_t>(mLoad(pageTable+pageIndex, 4));
-  const uint32_t physicalFrame = getPageMap(tableEntry);
+  // Entries are 4 bytes wide
+  const uint32_t rootAddress = st.protectedReg[RPT] + rootIndex*4;
+  const auto rootLoad = mLoad<4>(rootAddress);
+
+  if(!rootLoad){
+    return std::nullopt;
+  }
+
+  uint32_t rootEntry = static_cast<uint32_t>(rootLoad.value());
+  const auto pageTable = getPageMap(rootEntry);
+
+  if(!pageTable){
+    return std::nullopt;
+  }
+
+  const uint32_t tableAddress = pageTable.value() + pageIndex*4;
+  const auto tableLoad = mLoad<4>(tableAddress);
+
+  if(!tableLoad){
+    return std::nullopt;
+  }
+
+  uint32_t tableEntry = static_cast<uint32_t>(tableLoad.value());
+  const auto mappedFrame = getPageMap(tableEntry);
+
+  if(!mappedFrame){
+    return std::nullopt;
+  }
+
+  const uint32_t physicalFrame = mappedFrame.value();
 
   tableEntry |= PE::ACCESSED;
   rootEntry |= PE::ACCESSED;
   if(write)
     tableEntry |= PE::MODIFIED;
 
-  mStore(st.protectedReg[RPT]+rootIndex, tableEntry, 4);
-  mStore(pageTable+pageIndex, tableEntry, 4);
+  mStore<4>(rootAddress, rootEntry);
+  mStore<4>(tableAddress, tableEntry);
+
+  // Cache the walk, write permission only once MODIFIED has been recorded
+  const bool protectedMode = st.protectedReg[EFLAGS] & EF::PROTECTED_ENABLE;
+  const uint32_t tag = (address >> pageShift) | (protectedMode ? TLB::PROTECTED_TAG : 0);
+  TLBEntry &entry = tlb[tag % tlbEntries];
+
+  if(entry.tag != tag){
+    entry = TLBEntry{tag, physicalFrame, 0};
+  }
+
+  entry.perms |= TLB::READ;
+  if(write){
+    entry.perms |= TLB::WRITE;
+  }
+  if(!protectedMode || (rootEntry & tableEntry & PE::EXECUTABLE)){
+    entry.perms |= TLB::EXEC;
+  }
 
   return physicalFrame+offset;
 }
@@ -407,6 +1482,14 @@ uint32_t CPU::resolveAddress(const uint32_t address, const bool write, const boo
 Inst CPU::decodeBinRegInst(const uint32_t inst){
   Inst decoded{};
   decoded.opcode = static_cast<uint8_t>(inst >> 24);
+  // Ops without a lane width must not have (w) set
+  if(hasLaneWidth(decoded.opcode & OPCODE_MASK)){
+    decoded.width = decoded.opcode >> LANE_WIDTH_SHIFT;
+    decoded.opcode &= OPCODE_MASK;
+  }
+  else if(decoded.opcode >= FUSED_START){
+    decoded.opcode = invalidOpcode;
+  }
   decoded.r0 = static_cast<uint8_t>((inst & 0x00F00000) >> 20);
   decoded.r1 = static_cast<uint8_t>((inst & 0x000F0000) >> 16);
   decoded.offset = static_cast<int16_t>(inst);
@@ -1,15 +1,44 @@
 #pragma once
 
 #include "src/common/defs.hpp"
+#include "src/emulator/bus.hpp"
+#include "src/emulator/memory.hpp"
+#include "src/emulator/profile.hpp"
+#include "src/emulator/trace.hpp"
+#include "src/emulator/vector.hpp"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <type_traits>
 #include <vector>
 
-// To be thrown as an exception
+// Labels as values let each opcode jump straight to its handler, the run
+// loop also relies on its per-instruction helpers being inlined
+#if defined(__GNUC__)
+#define IDEALVM_COMPUTED_GOTO
+#define IDEALVM_ALWAYS_INLINE [[gnu::always_inline]] inline
+#elif defined(_MSC_VER)
+#define IDEALVM_ALWAYS_INLINE __forceinline
+#else
+#define IDEALVM_ALWAYS_INLINE inline
+#endif
+
+inline constexpr uint32_t pageShift = 12;
+inline constexpr uint32_t pageSize = 1 << pageShift;
+inline constexpr uint64_t bulkChunk = 16 * pageSize; // Most bytes one MCPY or MSET execution moves
+
+// Raised by an instruction and delivered once it has finished executing
 struct Interrupt {
-  IntCode code;
+  IntCode code{};
   uint64_t info{0};
   Interrupt(const IntCode code, const uint64_t info) : code{code}, info{info}
   {};
+  Interrupt() = default;
 };
 
 // Decoded binary register operation instruction
@@ -17,57 +46,323 @@ struct Inst {
   uint8_t opcode;
   uint8_t r0; // Only 4 bits of the registers are used
   uint8_t r1;
+  uint8_t width; // Lane width of vector ops, see hasLaneWidth
   int16_t offset;
 };
 
+// Software TLB permission bits, each set only once a walk has proven the access
+namespace TLB {
+  inline constexpr uint8_t READ = 0x1;
+  inline constexpr uint8_t WRITE = 0x2; // Also implies PE::MODIFIED is already set
+  inline constexpr uint8_t EXEC = 0x4;
+
+  // Tags carry the protection mode so privilege changes need no flush
+  inline constexpr uint32_t PROTECTED_TAG = 0x100000;
+  inline constexpr uint32_t INVALID_TAG = UINT32_MAX;
+}
+
+struct TLBEntry {
+  uint32_t tag{TLB::INVALID_TAG}; // Virtual page number | protection mode
+  uint32_t frame{};
+  uint8_t perms{};
+};
+
+inline constexpr uint32_t tlbEntries = 256; // Direct mapped
+
+// Pre-decoded instructions of one physical page, indexed by (offset >> 2)
+struct DecodedPage {
+  Inst insts[pageSize / 4];
+};
+
+// Mnemonic of an opcode, "INVALID" for reserved ones
+const char *opName(const uint8_t opcode);
+
+// Decoded opcodes past the architectural ones stand for two adjacent
+// instructions run by one dispatch, see decodePage. Their Inst is that of the
+// first instruction, the second is the next Inst of the page. Returns the
+// first opcode of a fused one, any other opcode unchanged.
+uint8_t unfusedOpcode(const uint8_t opcode);
+
+// Why CPU::run returned
+enum class StopReason : uint8_t {
+  BUDGET_EXHAUSTED,
+  HALT,         // HLT executed, the CPU stays halted
+  DOUBLE_FAULT, // Fault while entering a handler, the CPU cannot continue
+  BREAKPOINT,   // BRK executed, run may be called again to resume
+};
+
+struct JIT;
+struct Machine;
+
 struct CPU {
   struct State {
     uint64_t registers[16]{};
     uint64_t protectedReg[16]{};
 
     uint64_t ip{0}; // Current instruction pointer
+
+    Vector vectors[16]{};
+  };
+
+  // Everything a guest needs to continue from where snapshot was called.
+  // Counters are guest visible through PRD, so forks and restores carry on
+  // counting from the snapshot. Devices hold their own state and are not
+  // copied, a fork is attached to the same bus as the CPU it came from.
+  struct Snapshot {
+    State st;
+    uint64_t nip;
+    bool nipSet;
+    bool handlingInterrupt;
+    bool halted;
+    uint64_t timerCountdown;
+    uint64_t irqPending;
+    uint64_t retired;
+    uint64_t pageFaults;
+    uint64_t pageWalks;
+    uint64_t interruptsTaken;
+    MemorySnapshot memory;
+    std::shared_ptr<Bus> bus;
   };
 
   State st;         // Internal state of CPU at start of clock
-  std::vector<uint8_t> memory;
+  std::shared_ptr<GuestMemory> memory; // Shared by every hart of a Machine
+  bool sharedMemory{false}; // Other harts may write code, see Machine
+  Machine *machine{nullptr}; // Set on harts of a Machine
+  std::atomic<bool> codeStale{false}; // Set by other harts, see Machine::invalidateDecoded
 
   uint64_t nip{};     // New instruction pointer
   bool nipSet{false}; // Should nip be used?
   bool handlingInterrupt{false}; // Is an interrupt being handled?
 
+  // Arithmetic flags of the last ALU op, folded into EFLAGS on demand
+  bool flagsLazy{false};
+  uint8_t flagsOp{};
+  uint64_t flagsO1{};
+  uint64_t flagsO2{};
+  uint64_t flagsResult{};
+
+  Interrupt pendingInterrupt{};
+  bool interruptPending{false}; // Set by raise, the faulting instruction must stop
+
+  bool stopRequested{false}; // Leave run after the current instruction
+  StopReason stopReason{};
+  bool halted{false}; // Only a hardware interrupt can wake the CPU
+  bool doubleFaulted{false};
+  // Performance counters over all calls to run, also read by the guest, see
+  // ProtectedReg::RETIRED
+  uint64_t retired{0};
+  uint64_t pageFaults{0};
+  uint64_t pageWalks{0}; // Translations the TLB could not answer
+  uint64_t interruptsTaken{0};
+  uint64_t sliceRetired{0}; // Retired in the current slice, only kept up to date for PRD
+
+  // Programmable timer counting retired instructions, see TIMER
+  uint64_t timerCountdown{0}; // Instructions until the next tick, 0 when stopped
+  bool timerRearm{false};     // TIMER was written during the current slice
+
+  // Hardware interrupts waiting for INTERRUPT_ENABLE, see irqBit
+  uint64_t irqPending{0};
+
+  // Decoded instruction cache, built lazily per physical page
+  std::vector<std::unique_ptr<DecodedPage>> decodedPages;
+  // Virtual page of fetchDecoded (low bits clear), also cleared by other
+  // harts to send this one down the slow path, see Machine::invalidateDecoded
+  std::atomic<uint64_t> fetchTag{UINT64_MAX};
+  const DecodedPage *fetchDecoded{nullptr};
+  uint32_t fetchPage{UINT32_MAX}; // Physical page last cached in fetchDecoded, survives flushes
+  std::unique_ptr<DecodedPage> runningDecoded{}; // Invalidated page of the running instruction
+  Inst slowPathInst{}; // Instructions fetched without the cache
+
+  TLBEntry tlb[tlbEntries]{};
+
+  JIT *jit{nullptr}; // Optional compiled tier, told when code or translations change
+#ifdef IDEALVM_PROFILE
+  Profile profile{};
+  void countInstruction(const uint64_t ip, const uint8_t opcode);
+#endif
+  std::shared_ptr<Bus> bus{std::make_shared<Bus>()}; // Devices past the end of memory, also shared
+  std::unique_ptr<TraceRing> trace{}; // Records every instruction run interprets while set
+
   CPU(State s, const size_t memSize);
+  CPU(State s, std::shared_ptr<GuestMemory> sharedMemory);
+  // Fork, memory pages are shared with the snapshot until written
+  explicit CPU(const Snapshot &snapshot);
 
+  // Both remap guest memory, which the harts of a Machine share, so no hart
+  // of the Machine may be inside run, not just this one. restore keeps this
+  // CPU's bus.
+  Snapshot snapshot(void);
+  void restore(const Snapshot &snapshot);
+
+  // Execute up to budget instructions
+  StopReason run(const uint64_t budget);
+  template<bool traced> StopReason runSlice(const uint64_t budget);
+  bool retire(uint64_t &ip, uint64_t &remaining);
   void progressClock(void);
-  uint32_t fetchInstruction(void);
-  void dispatchInstruction(const uint32_t inst);
+  const Inst *fetchInst(const uint64_t ip);
+  const Inst *fetchInstSlow(const uint64_t ip);
+  uint32_t fetchInstruction(const uint64_t ip);
+  void dispatchInstruction(const Inst &decoded);
   Inst decodeBinRegInst(const uint32_t inst);
+  TraceRecord &traceBegin(const uint64_t ip, const Inst &inst);
+  void traceEnd(TraceRecord &record, const Inst &inst);
+
+  // One instantiation per opcode, indexed by opcode in handlers
+  using Handler = void (CPU::*)(const Inst &);
+  static const std::array<Handler, 256> handlers;
 
-  void executeBinaryRegOp(const Inst &inst);
-  void executeConditional(const Inst &inst);
-  void executeLoad(const Inst &inst);
-  void executeStore(const Inst &inst);
-  void executeStack(const Inst &inst);
-  void executePriviliged(const Inst &inst);
-  void executeMisc(const Inst &inst);
+  template<Op op> void executeBinaryRegOp(const Inst &inst);
+  template<Op op> void executeConditional(const Inst &inst);
+  template<Op op> void executeLoad(const Inst &inst);
+  template<Op op> void executeStore(const Inst &inst);
+  template<Op op> void executeStack(const Inst &inst);
+  template<Op op> void executePriviliged(const Inst &inst);
+  template<Op op> void executeMisc(const Inst &inst);
+  template<Op op> void executeAtomic(const Inst &inst);
+  template<Op op> void executeBulk(const Inst &inst);
+  template<Op op> void executeVector(const Inst &inst);
+  void executeInvalid(const Inst &inst);
   bool didOverflow(const uint64_t a, const uint64_t b,
                    const uint64_t res);
+  void materializeFlags(void);
+  void clearArithmeticFlags(void);
+  uint64_t branchFlags(void) const;
+
+  void raise(const IntCode code, const uint64_t info);
+  void deliverPendingInterrupt(void);
+  void requestStop(const StopReason reason);
+  void doubleFault(void);
+  void handleInterrupt(const Interrupt &i, const uint64_t rip);
 
-  void handleInterrupt(Interrupt &i);
+  // Timer, run never lets a slice cross a tick
+  uint64_t timerSlice(const uint64_t budget) const;
+  void advanceTimer(const uint64_t executed);
+  void writeTimer(const uint64_t interval);
+
+  // Hardware interrupts raised by the timer and devices, only the first 64
+  // hardware codes fit the pending mask
+  static constexpr uint64_t irqBit(const IntCode code){
+    return uint64_t{1} << (code - IntCode::HW_INTERRUPT_START);
+  }
+  void raiseIRQ(const IntCode code);
+  bool irqDeliverable(void) const;
+  bool canWake(void) const;
+  void deliverIRQ(void);
+  void yieldSlice(void);
   
-  uint32_t resolveAddress(const uint32_t address, const bool write = false,
-                          const bool jump = false);
+  // Translation raises a page fault and returns nullopt on failure
+  std::optional<uint32_t> resolveAddress(const uint32_t address, const bool write = false,
+                                         const bool jump = false);
+  std::optional<uint32_t> walkPageTable(const uint32_t address, const bool write,
+                                        const bool jump);
+
+  // Decoded instruction cache maintenance
+  const DecodedPage *decodePage(const uint32_t physicalPage);
+  void invalidateDecoded(const uint32_t physicalAddress, const uint64_t nBytes);
+  void invalidateIfDecoded(const uint32_t physicalAddress, const uint8_t nBytes);
+  void dropDecoded(void);
+  void dropStaleDecoded(void);
+  void flushFetchTranslation(void);
+  void flushTLB(void);
 
-  // Stack helpers
-  void stackPush(const uint64_t value);
-  uint64_t stackPop(void);
+  // Stack helpers, a failed access raises and leaves SP unchanged
+  bool stackPush(const uint64_t value);
+  std::optional<uint64_t> stackPop(void);
 
-  // Helpers for loading and storing respecting endianness
-  uint64_t mLoad(const uint32_t physicalAddress, const uint8_t nBytes);
-  void mStore(const uint32_t physicalAddress, uint64_t data,
-              const uint8_t nBytes);
+  // Little-endian physical memory access, bounds checked once per access.
+  // Addresses outside memory go to the bus, and raise a bus fault if no
+  // device is there. Aligned accesses are atomic with acquire loads and
+  // release stores, see Machine.
+  template<uint8_t nBytes> std::optional<uint64_t> mLoad(const uint32_t physicalAddress);
+  template<uint8_t nBytes> bool mStore(const uint32_t physicalAddress, const uint64_t data);
+  bool busLoad(const uint32_t physicalAddress, const uint8_t nBytes, uint64_t &value);
+  bool busStore(const uint32_t physicalAddress, const uint8_t nBytes, const uint64_t data);
+  uint64_t bulkCopy(const uint32_t to, const uint32_t from, const uint64_t n, const bool backward);
+  uint64_t bulkFill(const uint32_t to, const uint8_t value, const uint64_t n);
 };
 
+template<uint8_t nBytes>
+using MemoryWord = std::conditional_t<nBytes == 1, uint8_t,
+                   std::conditional_t<nBytes == 2, uint16_t,
+                   std::conditional_t<nBytes == 4, uint32_t, uint64_t>>>;
+
+template<uint8_t nBytes>
+IDEALVM_ALWAYS_INLINE std::optional<uint64_t> CPU::mLoad(const uint32_t physicalAddress){
+  static_assert(nBytes == 1 || nBytes == 2 || nBytes == 4 || nBytes == 8);
+
+  // The engaged flag must stay a constant per path, merging an optional
+  // returned by a call makes GCC spill it on the fast path too
+  if(physicalAddress + uint64_t{nBytes} > memory->size()){
+    uint64_t deviceValue;
+    if(!busLoad(physicalAddress, nBytes, deviceValue)){
+      return std::nullopt;
+    }
+    return deviceValue;
+  }
+
+  // Memory is page aligned, so physical alignment is host alignment
+  uint8_t *address = memory->data() + physicalAddress;
+  MemoryWord<nBytes> value;
+
+  if(physicalAddress % nBytes == 0){
+    value = std::atomic_ref(*reinterpret_cast<MemoryWord<nBytes> *>(address))
+              .load(std::memory_order_acquire);
+  }
+  else{
+    std::memcpy(&value, address, nBytes);
+  }
+
+  if constexpr(std::endian::native == std::endian::big){
+    value = std::byteswap(value);
+  }
+
+  return value;
+}
+
+template<uint8_t nBytes>
+IDEALVM_ALWAYS_INLINE bool CPU::mStore(const uint32_t physicalAddress, const uint64_t data){
+  static_assert(nBytes == 1 || nBytes == 2 || nBytes == 4 || nBytes == 8);
+
+  if(physicalAddress + uint64_t{nBytes} > memory->size()){
+    return busStore(physicalAddress, nBytes, data);
+  }
+
+  invalidateIfDecoded(physicalAddress, nBytes);
+
+  auto value = static_cast<MemoryWord<nBytes>>(data);
+
+  if constexpr(std::endian::native == std::endian::big){
+    value = std::byteswap(value);
+  }
+
+  uint8_t *address = memory->data() + physicalAddress;
+
+  if(physicalAddress % nBytes == 0){
+    std::atomic_ref(*reinterpret_cast<MemoryWord<nBytes> *>(address))
+      .store(value, std::memory_order_release);
+  }
+  else{
+    std::memcpy(address, &value, nBytes);
+  }
+  return true;
+}
 
+// Zero and negative only depend on the result, so branches never pay for
+// carry and overflow
+IDEALVM_ALWAYS_INLINE uint64_t CPU::branchFlags(void) const{
+  if(!flagsLazy){
+    return st.protectedReg[EFLAGS] & (EF::ZERO | EF::NEGATIVE);
+  }
 
+  return (flagsResult == 0 ? EF::ZERO : 0) | (flagsResult >> 63 ? EF::NEGATIVE : 0);
+}
 
+// Called before every store to an in-bounds address, so both pages exist
+IDEALVM_ALWAYS_INLINE void CPU::invalidateIfDecoded(const uint32_t physicalAddress, const uint8_t nBytes){
+  const uint32_t firstPage = physicalAddress >> pageShift;
+  const uint32_t lastPage = (physicalAddress + nBytes - 1) >> pageShift;
 
+  if(decodedPages[firstPage] || decodedPages[lastPage]){
+    invalidateDecoded(physicalAddress, nBytes);
+  }
+}
@@ -0,0 +1,128 @@
+#include "debugmap.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+#ifdef IDEALVM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+DebugMap::~DebugMap(){
+#ifdef IDEALVM_MMAP
+  if(bytes){
+    munmap(const_cast<uint8_t *>(bytes), length);
+  }
+#endif
+}
+
+bool DebugMap::load(const std::filesystem::path &path){
+#ifdef IDEALVM_MMAP
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    return false;
+  }
+
+  struct stat info{};
+  if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(DebugMapHeader)){
+    close(fd);
+    return false;
+  }
+
+  void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED){
+    return false;
+  }
+
+  bytes = static_cast<const uint8_t *>(mapping);
+  length = info.st_size;
+#else
+  std::ifstream file(path, std::ios::binary);
+  if(!file){
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  bytes = contents.data();
+  length = contents.size();
+  if(length < sizeof(DebugMapHeader)){
+    return false;
+  }
+#endif
+
+  // Tables are checked against the file once so lookups need no bounds checks
+  const auto *candidate = reinterpret_cast<const DebugMapHeader *>(bytes);
+  const uint64_t expected = sizeof(DebugMapHeader) + uint64_t{candidate->symbolCount} * sizeof(DebugMapSymbol) +
+                            uint64_t{candidate->lineCount} * sizeof(DebugMapLine) + candidate->stringBytes;
+
+  if(std::memcmp(candidate->magic, DEBUG_MAP_MAGIC, sizeof(candidate->magic)) != 0 || expected != length ||
+     uint64_t{candidate->sourceName} + candidate->sourceNameLength > candidate->stringBytes){
+    return false;
+  }
+
+  symbols = reinterpret_cast<const DebugMapSymbol *>(bytes + sizeof(DebugMapHeader));
+  lines = reinterpret_cast<const DebugMapLine *>(symbols + candidate->symbolCount);
+  strings = reinterpret_cast<const char *>(lines + candidate->lineCount);
+
+  for(uint32_t i{0}; i < candidate->symbolCount; i++){
+    if(uint64_t{symbols[i].name} + symbols[i].nameLength > candidate->stringBytes){
+      return false;
+    }
+  }
+
+  header = candidate;
+  return true;
+}
+
+const DebugMapSymbol *DebugMap::symbol(const uint64_t address) const{
+  if(!header){
+    return nullptr;
+  }
+
+  const DebugMapSymbol *end = symbols + header->symbolCount;
+  const DebugMapSymbol *next = std::upper_bound(symbols, end, address, [](const uint64_t a, const DebugMapSymbol &s){
+    return a < s.address;
+  });
+
+  if(next == symbols){
+    return nullptr;
+  }
+
+  const DebugMapSymbol *found = next - 1;
+  return address - found->address < found->nBytes ? found : nullptr;
+}
+
+std::string_view DebugMap::name(const DebugMapSymbol &symbol) const{
+  return std::string_view(strings + symbol.name, symbol.nameLength);
+}
+
+std::optional<uint32_t> DebugMap::line(const uint64_t address) const{
+  if(!header){
+    return std::nullopt;
+  }
+
+  const DebugMapLine *end = lines + header->lineCount;
+  const DebugMapLine *found = std::lower_bound(lines, end, address, [](const DebugMapLine &l, const uint64_t a){
+    return l.address < a;
+  });
+
+  if(found == end || found->address != address){
+    return std::nullopt;
+  }
+  return found->line;
+}
+
+std::string_view DebugMap::source(void) const{
+  if(!header){
+    return {};
+  }
+  return std::string_view(strings + header->sourceName, header->sourceNameLength);
+}
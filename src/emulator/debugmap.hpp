@@ -0,0 +1,43 @@
+#pragma once
+
+#include "src/common/debugmap.hpp"
+#include "src/emulator/memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Read only view of a debug map written by the assembler. The file is
+// mapped rather than read, so loading costs the same for any image size and
+// lookups only touch the pages they search.
+struct DebugMap {
+  const uint8_t *bytes{nullptr};
+  size_t length{0};
+#ifndef IDEALVM_MMAP
+  std::vector<uint8_t> contents;
+#endif
+
+  const DebugMapHeader *header{nullptr};
+  const DebugMapSymbol *symbols{nullptr};
+  const DebugMapLine *lines{nullptr};
+  const char *strings{nullptr};
+
+  DebugMap() = default;
+  ~DebugMap();
+  DebugMap(const DebugMap &) = delete;
+  DebugMap &operator=(const DebugMap &) = delete;
+
+  // False if the file cannot be read or is not a debug map of this host's
+  // byte order, lookups then find nothing
+  bool load(const std::filesystem::path &path);
+
+  // Labelled region holding address
+  const DebugMapSymbol *symbol(const uint64_t address) const;
+  std::string_view name(const DebugMapSymbol &symbol) const;
+  // Source line of the instruction at address
+  std::optional<uint32_t> line(const uint64_t address) const;
+  // Name of the assembled file, empty without a map
+  std::string_view source(void) const;
+};
@@ -0,0 +1,310 @@
+#include "devices.hpp"
+#include "cpu.hpp"
+#include "machine.hpp"
+#include "src/common/defs.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+
+#ifdef IDEALVM_POSIX_IO
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <cstdio>
+#endif
+
+ConsoleDevice::ConsoleDevice(const int outputFd, const int inputFd)
+  : outputFd{outputFd}, inputFd{inputFd} {
+#ifdef IDEALVM_POSIX_IO
+  lineBuffered = isatty(outputFd);
+  inputClosed = inputFd < 0;
+#else
+  lineBuffered = true;
+  inputClosed = true;
+#endif
+}
+
+ConsoleDevice::~ConsoleDevice(){
+  flushOutput();
+}
+
+void ConsoleDevice::flush(void){
+  const std::scoped_lock guard{lock};
+  flushOutput();
+}
+
+// Output the host cannot take is dropped, the guest has no way to retry
+void ConsoleDevice::flushOutput(void){
+#ifdef IDEALVM_POSIX_IO
+  for(size_t done{0}; done < outputUsed;){
+    const ssize_t n = ::write(outputFd, output.data() + done, outputUsed - done);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      break;
+    }
+    done += n;
+  }
+#else
+  std::fwrite(output.data(), 1, outputUsed, outputFd == 2 ? stderr : stdout);
+  std::fflush(outputFd == 2 ? stderr : stdout);
+#endif
+  outputUsed = 0;
+}
+
+// Takes whatever is ready without waiting
+void ConsoleDevice::fillInput(void){
+  if(inputBegin < inputEnd || inputClosed){
+    return;
+  }
+
+#ifdef IDEALVM_POSIX_IO
+  pollfd ready{inputFd, POLLIN, 0};
+  if(poll(&ready, 1, 0) <= 0){
+    return;
+  }
+
+  const ssize_t n = ::read(inputFd, input.data(), input.size());
+  if(n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)){
+    inputClosed = true;
+    return;
+  }
+  if(n > 0){
+    inputBegin = 0;
+    inputEnd = n;
+  }
+#endif
+}
+
+std::optional<uint64_t> ConsoleDevice::read(CPU &, const uint32_t offset, const uint8_t){
+  const std::scoped_lock guard{lock};
+
+  switch(offset){
+    case MMIO::CONSOLE_DATA:
+      // Prompts should be visible before the guest waits on an answer
+      flushOutput();
+      fillInput();
+      if(inputBegin == inputEnd){
+        return UINT64_MAX;
+      }
+      return static_cast<uint8_t>(input[inputBegin++]);
+    case MMIO::CONSOLE_STATUS:
+      fillInput();
+      return (inputBegin < inputEnd ? MMIO::CONSOLE_INPUT_READY : 0) |
+             (inputClosed ? MMIO::CONSOLE_INPUT_CLOSED : 0);
+  }
+  return std::nullopt;
+}
+
+bool ConsoleDevice::write(CPU &, const uint32_t offset, const uint8_t, const uint64_t value){
+  const std::scoped_lock guard{lock};
+
+  switch(offset){
+    case MMIO::CONSOLE_DATA: {
+      const char c = static_cast<char>(value);
+      output[outputUsed++] = c;
+      if(outputUsed == output.size() || (lineBuffered && c == '\n')){
+        flushOutput();
+      }
+      return true;
+    }
+    case MMIO::CONSOLE_FLUSH:
+      flushOutput();
+      return true;
+  }
+  return false;
+}
+
+// Timer state lives in the CPU, so one instance serves every hart
+std::optional<uint64_t> TimerDevice::read(CPU &cpu, const uint32_t offset, const uint8_t nBytes){
+  if(nBytes != 8){
+    return std::nullopt;
+  }
+
+  switch(offset){
+    case MMIO::TIMER_INTERVAL:
+      return cpu.st.protectedReg[TIMER];
+    case MMIO::TIMER_PENDING:
+      return (cpu.irqPending & CPU::irqBit(IntCode::TIMER_CLOCK)) != 0;
+  }
+  return std::nullopt;
+}
+
+bool TimerDevice::write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value){
+  if(nBytes != 8){
+    return false;
+  }
+
+  switch(offset){
+    case MMIO::TIMER_INTERVAL:
+      cpu.writeTimer(value);
+      return true;
+    case MMIO::TIMER_PENDING:
+      if(value == 0){
+        cpu.irqPending &= ~CPU::irqBit(IntCode::TIMER_CLOCK);
+      }
+      return true;
+  }
+  return false;
+}
+
+BlockDevice::~BlockDevice(){
+#ifdef IDEALVM_POSIX_IO
+  if(fd >= 0){
+    close(fd);
+  }
+#endif
+}
+
+bool BlockDevice::open(const std::filesystem::path &path){
+#ifdef IDEALVM_POSIX_IO
+  fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if(fd < 0 && (errno == EACCES || errno == EROFS)){
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    readOnly = true;
+  }
+
+  struct stat info{};
+  if(fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)){
+    return false;
+  }
+  capacity = static_cast<uint64_t>(info.st_size) / MMIO::BLOCK_SECTOR_SIZE;
+#else
+  std::error_code error;
+  const auto size = std::filesystem::file_size(path, error);
+  if(error){
+    return false;
+  }
+
+  file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+  if(!file){
+    file.open(path, std::ios::binary | std::ios::in);
+    readOnly = true;
+  }
+  if(!file){
+    return false;
+  }
+  capacity = size / MMIO::BLOCK_SECTOR_SIZE;
+#endif
+  return true;
+}
+
+std::optional<uint64_t> BlockDevice::read(CPU &cpu, const uint32_t offset, const uint8_t nBytes){
+  if(nBytes != 8){
+    return std::nullopt;
+  }
+
+  const std::scoped_lock guard{lock};
+
+  switch(offset){
+    case MMIO::BLOCK_SECTOR:
+      return sector;
+    case MMIO::BLOCK_COUNT:
+      return count;
+    case MMIO::BLOCK_BUFFER:
+      return buffer;
+    case MMIO::BLOCK_STATUS:
+      // Polling guests never see a stale completion once they enable interrupts
+      cpu.irqPending &= ~CPU::irqBit(IntCode::BLOCK_COMPLETE);
+      return status;
+    case MMIO::BLOCK_CAPACITY:
+      return capacity;
+  }
+  return std::nullopt;
+}
+
+bool BlockDevice::write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value){
+  if(nBytes != 8){
+    return false;
+  }
+
+  const std::scoped_lock guard{lock};
+
+  switch(offset){
+    case MMIO::BLOCK_SECTOR:
+      sector = value;
+      return true;
+    case MMIO::BLOCK_COUNT:
+      count = value;
+      return true;
+    case MMIO::BLOCK_BUFFER:
+      buffer = value;
+      return true;
+    case MMIO::BLOCK_COMMAND:
+      status = transfer(cpu, value);
+      cpu.raiseIRQ(IntCode::BLOCK_COMPLETE);
+      return true;
+  }
+  return false;
+}
+
+// The buffer is physical and must lie in RAM, like DMA it bypasses paging
+uint64_t BlockDevice::transfer(CPU &cpu, const uint64_t command){
+  const bool reading = command == MMIO::BLOCK_READ;
+
+  if(!reading && (command != MMIO::BLOCK_WRITE || readOnly)){
+    return MMIO::BLOCK_ERROR;
+  }
+
+  // Range checks are ordered so nothing can overflow
+  const uint64_t memorySize = cpu.memory->size();
+  if(sector > capacity || count > capacity - sector || buffer > memorySize ||
+     count > (memorySize - buffer) / MMIO::BLOCK_SECTOR_SIZE){
+    return MMIO::BLOCK_ERROR;
+  }
+
+  const uint64_t length = count * MMIO::BLOCK_SECTOR_SIZE;
+  const uint64_t position = sector * MMIO::BLOCK_SECTOR_SIZE;
+  uint8_t *data = cpu.memory->data() + buffer;
+
+  if(length == 0){
+    return MMIO::BLOCK_OK;
+  }
+
+#ifdef IDEALVM_POSIX_IO
+  // Large transfers come back in several pieces
+  uint64_t done{0};
+  while(done < length){
+    const ssize_t n = reading ? pread(fd, data + done, length - done, position + done) :
+                                pwrite(fd, data + done, length - done, position + done);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    // Zero means the file was truncated behind our back
+    if(n <= 0){
+      break;
+    }
+    done += n;
+  }
+  const bool failed = done < length;
+#else
+  file.clear();
+  file.seekg(position);
+  if(reading){
+    file.read(reinterpret_cast<char *>(data), length);
+  }
+  else{
+    file.write(reinterpret_cast<const char *>(data), length);
+    file.flush();
+  }
+  // A failed read may still have stored part of the buffer
+  const bool failed = !file;
+  const uint64_t done = reading && failed ? static_cast<uint64_t>(file.gcount()) : length;
+#endif
+
+  // Other harts may have the old contents decoded too, even of a read that
+  // failed partway
+  if(reading && done > 0 && cpu.machine){
+    cpu.machine->invalidateDecoded(cpu, static_cast<uint32_t>(buffer), done);
+  }
+  else if(reading && done > 0){
+    cpu.invalidateDecoded(static_cast<uint32_t>(buffer), done);
+  }
+  return failed ? MMIO::BLOCK_ERROR : MMIO::BLOCK_OK;
+}
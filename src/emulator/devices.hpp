@@ -0,0 +1,97 @@
+#pragma once
+
+#include "src/emulator/bus.hpp"
+#include "src/emulator/memory.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+
+// Devices talk to host files and terminals through raw descriptors on POSIX
+// hosts, elsewhere through the C and C++ streams
+#if defined(__unix__) || defined(__APPLE__)
+#define IDEALVM_POSIX_IO
+#endif
+
+// Byte console on the host's stdin and stdout, see MMIO::CONSOLE_DATA.
+// Output is buffered and written in one go once a line ends on a terminal,
+// the buffer fills, the guest asks, input is read or the owner calls flush,
+// so chatty guests cost a write per line at most. Input never blocks.
+struct ConsoleDevice : Device {
+  static constexpr size_t outputCapacity = 0x10000;
+  static constexpr size_t inputCapacity = 0x1000;
+
+  std::mutex lock;
+  int outputFd;
+  int inputFd;
+  bool lineBuffered; // Only interactive output is flushed per line, like stdio
+
+  std::array<char, outputCapacity> output{};
+  size_t outputUsed{0};
+
+  std::array<char, inputCapacity> input{};
+  size_t inputBegin{0};
+  size_t inputEnd{0};
+  bool inputClosed{false};
+
+  // A negative inputFd gives a console whose input is closed
+  explicit ConsoleDevice(const int outputFd = 1, const int inputFd = 0);
+  ~ConsoleDevice() override;
+  ConsoleDevice(const ConsoleDevice &) = delete;
+  ConsoleDevice &operator=(const ConsoleDevice &) = delete;
+
+  std::optional<uint64_t> read(CPU &cpu, const uint32_t offset, const uint8_t nBytes) override;
+  bool write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value) override;
+
+  // Called by the host once guests stop, also done on destruction
+  void flush(void);
+
+  // Callers hold lock
+  void flushOutput(void);
+  void fillInput(void);
+};
+
+// MMIO view of the accessing hart's timer, see MMIO::TIMER_INTERVAL
+struct TimerDevice : Device {
+  std::optional<uint64_t> read(CPU &cpu, const uint32_t offset, const uint8_t nBytes) override;
+  bool write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value) override;
+};
+
+// Disk backed by a host file, see MMIO::BLOCK_SECTOR. A command is a single
+// pread or pwrite between the file and guest memory, finished before the
+// store that issued it retires. Harts share the registers, so they are
+// behind a lock. A read over code invalidates it on every hart of the
+// Machine, not just the one that issued it, see Machine::invalidateDecoded.
+struct BlockDevice : Device {
+  std::mutex lock;
+#ifdef IDEALVM_POSIX_IO
+  int fd{-1};
+#else
+  std::fstream file;
+#endif
+  bool readOnly{false};
+  uint64_t capacity{0}; // In sectors, a partial last sector is not reachable
+
+  uint64_t sector{0};
+  uint64_t count{0};
+  uint64_t buffer{0};
+  uint64_t status{0};
+
+  BlockDevice() = default;
+  ~BlockDevice() override;
+  BlockDevice(const BlockDevice &) = delete;
+  BlockDevice &operator=(const BlockDevice &) = delete;
+
+  // Files that cannot be written are attached read only, false if the file
+  // cannot be opened at all
+  bool open(const std::filesystem::path &path);
+
+  std::optional<uint64_t> read(CPU &cpu, const uint32_t offset, const uint8_t nBytes) override;
+  bool write(CPU &cpu, const uint32_t offset, const uint8_t nBytes, const uint64_t value) override;
+
+  // Runs command on the current registers, returns the new status
+  uint64_t transfer(CPU &cpu, const uint64_t command);
+};
@@ -0,0 +1,675 @@
+#include "jit.hpp"
+#include "src/common/defs.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef IDEALVM_JIT
+#include <sys/mman.h>
+#endif
+
+#ifdef IDEALVM_JIT
+
+namespace {
+
+// x86-64 register numbers, only the legacy eight are used so no REX.R/B
+enum HostReg : uint8_t {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3, // CPU::State *, callee saved
+  RSP = 4,
+  RBP = 5, // JITContext *, callee saved
+  RSI = 6,
+  RDI = 7,
+};
+
+// Condition codes for jcc
+enum Cond : uint8_t {
+  BELOW = 0x2,
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+  BELOW_EQUAL = 0x6,
+};
+
+constexpr uint8_t REXW = 0x48;
+
+constexpr int32_t registerOffset(const uint8_t reg){
+  return static_cast<int32_t>(offsetof(CPU::State, registers) + reg * 8);
+}
+constexpr int32_t eflagsOffset = offsetof(CPU::State, protectedReg) + EFLAGS * 8;
+constexpr int32_t ipOffset = offsetof(CPU::State, ip);
+constexpr int32_t retiredOffset = offsetof(JITContext, retired);
+constexpr int32_t limitOffset = offsetof(JITContext, limit);
+constexpr int32_t cpuOffset = offsetof(JITContext, cpu);
+
+// Appends machine code to the JIT buffer, callers reserve space up front
+struct Emitter {
+  uint8_t *base;
+  size_t pos;
+
+  size_t position(void) const { return pos; }
+  const uint8_t *here(void) const { return base + pos; }
+
+  void u8(const uint8_t value){ base[pos++] = value; }
+  void u32(const uint32_t value){ std::memcpy(base + pos, &value, 4); pos += 4; }
+  void u64(const uint64_t value){ std::memcpy(base + pos, &value, 8); pos += 8; }
+
+  static uint8_t modrm(const uint8_t mod, const uint8_t reg, const uint8_t rm){
+    return static_cast<uint8_t>(mod << 6 | reg << 3 | rm);
+  }
+
+  // op r64, [base + disp32], base must be RBX or RBP
+  void memOp(const uint8_t opcode, const uint8_t reg, const uint8_t baseReg, const int32_t disp){
+    u8(REXW); u8(opcode); u8(modrm(0b10, reg, baseReg)); u32(disp);
+  }
+  void load(const uint8_t reg, const uint8_t baseReg, const int32_t disp){ memOp(0x8B, reg, baseReg, disp); }
+  void store(const uint8_t baseReg, const int32_t disp, const uint8_t reg){ memOp(0x89, reg, baseReg, disp); }
+
+  // op dst, src with the 0x01 style (r/m, reg) encoding
+  void regOp(const uint8_t opcode, const uint8_t dst, const uint8_t src){
+    u8(REXW); u8(opcode); u8(modrm(0b11, src, dst));
+  }
+  void mov(const uint8_t dst, const uint8_t src){ regOp(0x89, dst, src); }
+
+  // Group 1 ops with a sign extended immediate, ext selects add/or/adc/and/sub/cmp
+  void immOp(const uint8_t ext, const uint8_t reg, const int32_t imm){
+    if(imm >= -128 && imm <= 127){
+      u8(REXW); u8(0x83); u8(modrm(0b11, ext, reg)); u8(static_cast<uint8_t>(imm));
+    }
+    else{
+      u8(REXW); u8(0x81); u8(modrm(0b11, ext, reg)); u32(static_cast<uint32_t>(imm));
+    }
+  }
+
+  void shiftImm(const uint8_t ext, const uint8_t reg, const uint8_t count){
+    u8(REXW); u8(0xC1); u8(modrm(0b11, ext, reg)); u8(count);
+  }
+
+  void movImm(const uint8_t reg, const uint64_t imm){
+    if(static_cast<int64_t>(imm) == static_cast<int32_t>(imm)){
+      u8(REXW); u8(0xC7); u8(modrm(0b11, 0, reg)); u32(static_cast<uint32_t>(imm));
+    }
+    else{
+      u8(REXW); u8(0xB8 + reg); u64(imm);
+    }
+  }
+
+  void zero32(const uint8_t reg){ u8(0x31); u8(modrm(0b11, reg, reg)); }
+
+  // Returns the position of the rel32 for patching
+  size_t jmp(void){ u8(0xE9); u32(0); return pos - 4; }
+  size_t jcc(const Cond cond){ u8(0x0F); u8(0x80 + cond); u32(0); return pos - 4; }
+
+  void patch(const size_t rel32, const uint8_t *target){
+    const auto rel = static_cast<int32_t>(target - (base + rel32 + 4));
+    std::memcpy(base + rel32, &rel, 4);
+  }
+  void jmpTo(const uint8_t *target){ patch(jmp(), target); }
+  void bind(const size_t rel32){ patch(rel32, here()); }
+};
+
+enum class Kind : uint8_t {
+  NATIVE,      // Compiled inline
+  INTERPRETED, // Calls the interpreter handler, may fault
+  BRANCH,      // Ends the block
+  UNSUPPORTED, // Left to the interpreter, ends the block before it
+};
+
+Kind classify(const uint8_t opcode){
+  switch(opcode){
+    case Op::MOV: case Op::GEF:
+    case Op::AND: case Op::OR: case Op::XOR: case Op::SHL: case Op::SHR:
+    case Op::ADD: case Op::SUB: case Op::MUL:
+      return Kind::NATIVE;
+    case Op::LB: case Op::LBU: case Op::LH: case Op::LHU: case Op::LW: case Op::LWU: case Op::LD:
+    case Op::SB: case Op::SH: case Op::SW: case Op::SD:
+    case Op::PUSH: case Op::POP:
+    case Op::SMUL: case Op::DIV: case Op::SDIV: case Op::SSHR:
+    case Op::CAS: case Op::FADD:
+    case Op::VLD: case Op::VST: case Op::VADD: case Op::VSUB: case Op::VAND: case Op::VOR:
+    case Op::VXOR: case Op::VSHL: case Op::VSHR: case Op::VCEQ: case Op::VCGT:
+    case Op::VBRD: case Op::VGET:
+      return Kind::INTERPRETED;
+    case Op::JMP: case Op::JLT: case Op::JGT: case Op::JZR: case Op::JIF:
+      return Kind::BRANCH;
+    // MCPY and MSET run again through nip, which interpreted calls ignore
+    default:
+      return Kind::UNSUPPORTED;
+  }
+}
+
+// Native ops that overwrite every arithmetic flag
+bool writesFlags(const uint8_t opcode){
+  return classify(opcode) == Kind::NATIVE && opcode != Op::MOV && opcode != Op::GEF;
+}
+
+uint64_t packInst(const Inst &inst){
+  return uint64_t{inst.opcode} | uint64_t{inst.r0} << 8 | uint64_t{inst.r1} << 16
+         | uint64_t{inst.width} << 24 | uint64_t{static_cast<uint16_t>(inst.offset)} << 32;
+}
+
+// Called from generated code with the instruction's ip: 0 if it raised, the
+// interrupt is delivered like the interpreter's retire does and st.ip is
+// where the guest continues, 2 if it modified code or asked run to stop
+uint8_t jitInterpret(CPU *cpu, const uint64_t packed, const uint64_t ip){
+  const Inst inst{static_cast<uint8_t>(packed), static_cast<uint8_t>(packed >> 8),
+                  static_cast<uint8_t>(packed >> 16), static_cast<uint8_t>(packed >> 24),
+                  static_cast<int16_t>(packed >> 32)};
+
+  (cpu->*CPU::handlers[inst.opcode])(inst);
+  cpu->st.registers[Reg::Z] = 0;
+  cpu->materializeFlags(); // Generated code reads EFLAGS directly
+
+  if(cpu->interruptPending){
+    cpu->st.ip = ip;
+    cpu->deliverPendingInterrupt();
+    // The handler, or ip again after a double fault
+    cpu->st.ip = cpu->nip;
+    cpu->nipSet = false;
+    return 0;
+  }
+
+  return cpu->jit->stale || cpu->stopRequested ? 2 : 1;
+}
+
+// Second operand, register + offset
+void loadOperand(Emitter &e, const uint8_t reg, const Inst &inst){
+  if(inst.r1 == Reg::Z){
+    e.movImm(reg, static_cast<uint64_t>(int64_t{inst.offset}));
+    return;
+  }
+
+  e.load(reg, RBX, registerOffset(inst.r1));
+  if(inst.offset){
+    e.immOp(0, reg, inst.offset);
+  }
+}
+
+// Result in RAX, o1 in RSI and o2 in RCX, matches CPU::executeBinaryRegOp
+void emitFlags(Emitter &e, const uint8_t opcode){
+  if(opcode == Op::ADD || opcode == Op::SUB){
+    // Overflow when both operands share a sign the result lacks
+    e.mov(RDX, RSI); e.regOp(0x31, RDX, RCX);
+    e.u8(REXW); e.u8(0xF7); e.u8(Emitter::modrm(0b11, 2, RDX)); // not rdx
+    e.mov(RDI, RSI); e.regOp(0x31, RDI, RAX);
+    e.regOp(0x21, RDX, RDI);
+    e.shiftImm(5, RDX, 63);
+    e.shiftImm(4, RDX, 1);
+
+    // Carry from the unsigned compare the interpreter does
+    if(opcode == Op::ADD){
+      e.regOp(0x39, RAX, RSI);
+    }
+    else{
+      e.regOp(0x39, RSI, RCX);
+    }
+    e.immOp(2, RDX, 0); // adc rdx, 0
+  }
+  else{
+    e.zero32(RDX);
+  }
+
+  e.zero32(RDI);
+  e.immOp(7, RAX, 1); // Borrows only when zero
+  e.immOp(2, RDI, 0);
+  e.shiftImm(4, RDI, 2);
+  e.regOp(0x09, RDX, RDI);
+
+  e.mov(RDI, RAX);
+  e.shiftImm(5, RDI, 63);
+  e.shiftImm(4, RDI, 3);
+  e.regOp(0x09, RDX, RDI);
+
+  e.load(RDI, RBX, eflagsOffset);
+  e.immOp(4, RDI, static_cast<int32_t>(~(EF::CARRY | EF::OVERFLOW | EF::ZERO | EF::NEGATIVE)));
+  e.regOp(0x09, RDI, RDX);
+  e.store(RBX, eflagsOffset, RDI);
+}
+
+void emitNative(Emitter &e, const Inst &inst, const bool flagsLive){
+  if(inst.opcode == Op::GEF){
+    if(inst.r1 != Reg::Z){
+      e.load(RAX, RBX, eflagsOffset);
+      e.store(RBX, registerOffset(inst.r1), RAX);
+    }
+    return;
+  }
+
+  if(inst.opcode == Op::MOV){
+    if(inst.r0 != Reg::Z){
+      loadOperand(e, RAX, inst);
+      e.store(RBX, registerOffset(inst.r0), RAX);
+    }
+    return;
+  }
+
+  loadOperand(e, RCX, inst);
+  if(inst.r0 == Reg::Z){
+    e.zero32(RSI);
+  }
+  else{
+    e.load(RSI, RBX, registerOffset(inst.r0));
+  }
+  e.mov(RAX, RSI);
+
+  switch(inst.opcode){
+    case Op::AND: e.regOp(0x21, RAX, RCX); break;
+    case Op::OR:  e.regOp(0x09, RAX, RCX); break;
+    case Op::XOR: e.regOp(0x31, RAX, RCX); break;
+    case Op::ADD: e.regOp(0x01, RAX, RCX); break;
+    case Op::SUB: e.regOp(0x29, RAX, RCX); break;
+    case Op::MUL:
+      e.u8(REXW); e.u8(0x0F); e.u8(0xAF); e.u8(Emitter::modrm(0b11, RAX, RCX));
+      break;
+    case Op::SHL:
+    case Op::SHR:
+      e.u8(REXW); e.u8(0xD3); e.u8(Emitter::modrm(0b11, inst.opcode == Op::SHL ? 4 : 5, RAX));
+      // x86 masks the count, shifts of 64 or more must give 0
+      e.immOp(7, RCX, 64);
+      e.regOp(0x19, RDX, RDX); // sbb: all ones when the count was below 64
+      e.regOp(0x21, RAX, RDX);
+      break;
+  }
+
+  if(flagsLive){
+    emitFlags(e, inst.opcode);
+  }
+
+  if(inst.r0 != Reg::Z){
+    e.store(RBX, registerOffset(inst.r0), RAX);
+  }
+}
+
+} // namespace
+
+#endif
+
+JIT::JIT(CPU &cpu) : cpu{cpu} {
+  cpu.jit = this;
+
+#ifdef IDEALVM_JIT
+  void *mapping = mmap(nullptr, codeCapacity, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mapping == MAP_FAILED){
+    return;
+  }
+  code = static_cast<uint8_t *>(mapping);
+
+  Emitter e{code, 0};
+
+  // Entry trampoline: keep the state and context in callee saved registers,
+  // the extra 8 bytes realign the stack for helper calls
+  enter = reinterpret_cast<Entry>(code);
+  e.u8(0x53); // push rbx
+  e.u8(0x55); // push rbp
+  e.immOp(5, RSP, 8);
+  e.mov(RBX, RDI);
+  e.mov(RBP, RSI);
+  e.u8(0xFF); e.u8(Emitter::modrm(0b11, 4, RDX)); // jmp rdx
+
+  // Shared by every block exit, next ip in RAX
+  epilogue = e.here();
+  e.immOp(0, RSP, 8);
+  e.u8(0x5D); // pop rbp
+  e.u8(0x5B); // pop rbx
+  e.u8(0xC3);
+
+  stubsEnd = codeSize = e.position();
+#endif
+}
+
+JIT::~JIT(){
+  if(cpu.jit == this){
+    cpu.jit = nullptr;
+  }
+
+#ifdef IDEALVM_JIT
+  if(code){
+    munmap(code, codeCapacity);
+  }
+#endif
+}
+
+bool JIT::supported(void){
+#ifdef IDEALVM_JIT
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Deferred, blocks may still be running when this is called
+void JIT::invalidate(void){
+  stale = true;
+}
+
+void JIT::preempt(void){
+  std::atomic_ref(context.limit).store(0);
+}
+
+void JIT::flush(void){
+  blocks.clear();
+  heat.clear();
+  pendingLinks.clear();
+  codeSize = stubsEnd;
+  stale = false;
+}
+
+// Emitting and patching need RW, entering a block needs RX
+bool JIT::setExecutable(const bool executable){
+  if(this->executable == executable){
+    return true;
+  }
+
+#ifdef IDEALVM_JIT
+  if(mprotect(code, codeCapacity, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE)){
+    return false;
+  }
+#endif
+
+  this->executable = executable;
+  return true;
+}
+
+// Virtual ip in the high half, blockAt only compiles ips below 4GiB. Block
+// addresses are aligned, so the paging mode takes the lowest bit.
+uint64_t JIT::blockKey(const uint64_t ip, const uint32_t physicalAddress, const bool paging){
+  return ip << 32 | physicalAddress | paging;
+}
+
+// Compiled blocks are not traced, so a traced hart is only interpreted
+StopReason JIT::run(const uint64_t budget){
+  if(!code || cpu.doubleFaulted || cpu.trace){
+    return cpu.run(budget);
+  }
+
+  uint64_t remaining = budget;
+
+  while(remaining){
+    cpu.dropStaleDecoded();
+    if(stale){
+      flush();
+    }
+
+    // Halts and hardware interrupts are left to the interpreter
+    const bool interpret = cpu.halted || cpu.irqDeliverable();
+
+    const uint8_t *block = interpret ? nullptr : blockAt(cpu.st.ip);
+
+    if(block && setExecutable(true)){
+      context.retired = 0;
+      std::atomic_ref(context.limit).store(cpu.timerSlice(remaining));
+      context.cpu = &cpu;
+
+      // Preempted before the limit was set, see Machine::invalidateDecoded
+      if(cpu.codeStale.load()){
+        continue;
+      }
+
+      cpu.st.ip = enter(&cpu.st, &context, block);
+      cpu.retired += context.retired;
+      remaining -= context.retired;
+      cpu.advanceTimer(context.retired);
+
+      // Devices accessed by interpreted stores may want the slice to end
+      if(cpu.stopRequested){
+        cpu.stopRequested = false;
+        if(cpu.stopReason != StopReason::BUDGET_EXHAUSTED){
+          return cpu.stopReason;
+        }
+      }
+
+      if(context.retired){
+        continue;
+      }
+    }
+
+    // Cold code, unsupported instructions and faults
+    const uint64_t before = cpu.retired;
+    const StopReason reason = cpu.run(1);
+    remaining -= cpu.retired - before;
+
+    if(reason != StopReason::BUDGET_EXHAUSTED){
+      return reason;
+    }
+  }
+
+  return StopReason::BUDGET_EXHAUSTED;
+}
+
+const uint8_t *JIT::blockAt(const uint64_t ip){
+  if((ip & 0x3) || ip > UINT32_MAX){
+    return nullptr;
+  }
+
+  // Translated through the interpreter's fetch cache, so page walks happen
+  // exactly where the interpreter's would. A fetch fault is left pending for
+  // the interpreter to deliver.
+  const uint64_t virtualPage = ip & ~uint64_t{pageSize - 1};
+  if(virtualPage != cpu.fetchTag.load(std::memory_order_relaxed)){
+    cpu.fetchInstSlow(ip);
+    if(cpu.interruptPending || stale || virtualPage != cpu.fetchTag.load(std::memory_order_relaxed)){
+      return nullptr;
+    }
+  }
+
+  const uint32_t physicalAddress = cpu.fetchPage << pageShift | static_cast<uint32_t>(ip & (pageSize - 1));
+
+  const bool paging = cpu.st.protectedReg[EFLAGS] & EF::PAGING_ENABLE;
+  const uint64_t key = blockKey(ip, physicalAddress, paging);
+
+  if(const auto it = blocks.find(key); it != blocks.end()){
+    return it->second;
+  }
+
+  if(++heat[key] < hotThreshold){
+    return nullptr;
+  }
+
+  const uint8_t *block = compile(physicalAddress, ip);
+  blocks[key] = block;
+  return block;
+}
+
+#ifdef IDEALVM_JIT
+
+const uint8_t *JIT::compile(const uint32_t physicalAddress, const uint64_t ip){
+  const DecodedPage *page = cpu.decodePage(physicalAddress >> pageShift);
+
+  if(!page || !setExecutable(false)){
+    return nullptr;
+  }
+
+  std::vector<Inst> insts;
+  bool branches{false};
+
+  for(uint32_t index = (physicalAddress & (pageSize - 1)) >> 2;
+      index < pageSize / 4 && insts.size() < maxBlockLength; index++){
+    // Blocks already run several instructions per dispatch, so fused pairs
+    // are compiled as their two halves
+    Inst inst = page->insts[index];
+    inst.opcode = unfusedOpcode(inst.opcode);
+    const Kind kind = classify(inst.opcode);
+
+    if(kind == Kind::UNSUPPORTED){
+      break;
+    }
+
+    insts.push_back(inst);
+
+    if(kind == Kind::BRANCH){
+      branches = true;
+      break;
+    }
+  }
+
+  if(insts.empty()){
+    return nullptr;
+  }
+
+  // Flags only need computing where something can observe them: GEF, a
+  // conditional branch, an interpreted instruction or any block exit
+  std::vector<bool> flagsLive(insts.size());
+  bool live{true};
+  for(size_t i = insts.size(); i-- > 0;){
+    if(writesFlags(insts[i].opcode)){
+      flagsLive[i] = live;
+      live = false;
+    }
+    else if(insts[i].opcode != Op::MOV){
+      live = true;
+    }
+  }
+
+  // Generous upper bound on the encoded size of one block
+  constexpr size_t maxInstBytes = 160;
+  if(codeSize + (insts.size() + 4) * maxInstBytes > codeCapacity){
+    flush();
+  }
+
+  // Direct chaining relies on virtual == physical
+  const bool chain = !(cpu.st.protectedReg[EFLAGS] & EF::PAGING_ENABLE);
+  const auto n = static_cast<uint32_t>(insts.size());
+
+  Emitter e{code, codeSize};
+  const uint8_t *entry = e.here();
+
+  auto unretire = [&](const uint32_t unretired){
+    if(unretired){
+      e.u8(REXW); e.u8(0x81); e.u8(Emitter::modrm(0b10, 5, RBP)); e.u32(retiredOffset); e.u32(unretired);
+    }
+  };
+
+  auto exitTo = [&](const uint64_t target, const uint32_t unretired, const bool canChain){
+    unretire(unretired);
+
+    if(canChain && chain && !unretired && !(target & 0x3) && target <= UINT32_MAX){
+      const uint64_t key = blockKey(target, static_cast<uint32_t>(target), false);
+      const auto known = blocks.find(key);
+
+      if(known != blocks.end() && known->second){
+        e.jmpTo(known->second);
+        return;
+      }
+
+      const size_t link = e.jmp();
+      if(known == blocks.end()){
+        pendingLinks[key].push_back(link);
+      }
+      e.bind(link);
+    }
+
+    e.movImm(RAX, target);
+    e.jmpTo(epilogue);
+  };
+
+  // Budget check, a block only runs if all of it fits
+  e.load(RAX, RBP, retiredOffset);
+  e.immOp(0, RAX, static_cast<int32_t>(n));
+  e.memOp(0x3B, RAX, RBP, limitOffset); // cmp rax, [rbp + limit]
+  const size_t fits = e.jcc(BELOW_EQUAL);
+  e.movImm(RAX, ip);
+  e.jmpTo(epilogue);
+  e.bind(fits);
+  e.store(RBP, retiredOffset, RAX);
+
+  for(uint32_t k{0}; k < n; k++){
+    const Inst &inst = insts[k];
+    const uint64_t instIp = ip + uint64_t{k} * 4;
+
+    switch(classify(inst.opcode)){
+      case Kind::NATIVE:
+        emitNative(e, inst, flagsLive[k]);
+        break;
+
+      case Kind::INTERPRETED: {
+        e.load(RDI, RBP, cpuOffset);
+        e.movImm(RSI, packInst(inst));
+        e.movImm(RDX, instIp);
+        e.movImm(RAX, reinterpret_cast<uint64_t>(&jitInterpret));
+        e.u8(0xFF); e.u8(Emitter::modrm(0b11, 2, RAX)); // call rax
+        e.u8(0x3C); e.u8(1); // cmp al, 1
+        const size_t ok = e.jcc(EQUAL);
+        const size_t fault = e.jcc(BELOW);
+        // Code was modified, leave before running anything stale
+        exitTo(instIp + 4, n - k - 1, false);
+        // The raising instruction retired, continue in its handler
+        e.bind(fault);
+        unretire(n - k - 1);
+        e.load(RAX, RBX, ipOffset);
+        e.jmpTo(epilogue);
+        e.bind(ok);
+        break;
+      }
+
+      case Kind::BRANCH: {
+        size_t taken{};
+        bool conditional{true};
+
+        if(inst.opcode == Op::JMP){
+          conditional = false;
+        }
+        else if(inst.opcode == Op::JIF){
+          if(inst.r0 == Reg::Z){
+            exitTo(instIp + 4, 0, true);
+            break;
+          }
+          e.load(RAX, RBX, registerOffset(inst.r0));
+          e.regOp(0x85, RAX, RAX);
+          taken = e.jcc(NOT_EQUAL);
+        }
+        else{
+          e.load(RAX, RBX, eflagsOffset);
+          const uint32_t mask = inst.opcode == Op::JLT ? EF::NEGATIVE :
+                                inst.opcode == Op::JZR ? EF::ZERO : EF::ZERO | EF::NEGATIVE;
+          e.u8(REXW); e.u8(0xA9); e.u32(mask); // test rax, mask
+          taken = e.jcc(inst.opcode == Op::JGT ? EQUAL : NOT_EQUAL);
+        }
+
+        if(conditional){
+          exitTo(instIp + 4, 0, true);
+          e.bind(taken);
+        }
+
+        if(inst.r1 == Reg::Z){
+          exitTo(static_cast<uint64_t>(int64_t{inst.offset}), 0, true);
+        }
+        else{
+          loadOperand(e, RAX, inst);
+          e.jmpTo(epilogue);
+        }
+        break;
+      }
+
+      case Kind::UNSUPPORTED:
+        break;
+    }
+  }
+
+  if(!branches){
+    exitTo(ip + uint64_t{n} * 4, 0, true);
+  }
+
+  codeSize = e.position();
+
+  // Link every block that was waiting on this one
+  if(const auto waiting = pendingLinks.find(blockKey(ip, physicalAddress, !chain)); waiting != pendingLinks.end()){
+    for(const size_t link : waiting->second){
+      e.patch(link, entry);
+    }
+    pendingLinks.erase(waiting);
+  }
+
+  return entry;
+}
+
+#else
+
+const uint8_t *JIT::compile(const uint32_t, const uint64_t){
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "src/emulator/cpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Native code is only generated for x86-64 System V hosts, elsewhere the
+// JIT reports itself unsupported and every call falls through to CPU::run.
+// Profiling builds interpret everything so each instruction is counted.
+#if defined(__x86_64__) && defined(__unix__) && !defined(IDEALVM_PROFILE)
+#define IDEALVM_JIT
+#endif
+
+// Shared between the driver and generated blocks, accessed by offset
+struct JITContext {
+  uint64_t retired{}; // Instructions retired since the block was entered
+  uint64_t limit{};   // Blocks exit instead of retiring past this
+  CPU *cpu{};
+  uint64_t scratch{}; // Sink for results written to Z
+};
+
+// Translates guest basic blocks to x86-64 on first heavy use.
+//
+// ALU ops, MOV, GEF and branches are compiled natively with exact EFLAGS.
+// Loads, stores, stack ops and the remaining ALU ops call back into the
+// interpreter's handlers. A fault is delivered where it was raised and the
+// block leaves for the handler, so walks and counters match the interpreter.
+// Anything else ends the block.
+struct JIT {
+  // Entry trampoline, returns the next guest ip
+  using Entry = uint64_t (*)(CPU::State *state, JITContext *context, const void *block);
+
+  static constexpr uint32_t hotThreshold = 16; // Interpreted entries before compiling
+  static constexpr uint32_t maxBlockLength = 128;
+  static constexpr size_t codeCapacity = 16 << 20;
+
+  CPU &cpu;
+  JITContext context{};
+  bool stale{false}; // Code or translations changed, blocks dropped before next entry
+
+  uint8_t *code{nullptr};
+  bool executable{false}; // The buffer is mapped either RX or RW, never both
+  size_t codeSize{0};
+  size_t stubsEnd{0}; // Trampoline and shared epilogue live below this
+  Entry enter{nullptr};
+  const uint8_t *epilogue{nullptr};
+
+  // Block entry by blockKey, nullptr if the block cannot be compiled. Blocks
+  // bake their virtual ips into the exits, so aliases of a frame get their own,
+  // and only blocks compiled without paging chain, so each mode gets its own
+  std::unordered_map<uint64_t, const uint8_t *> blocks;
+  std::unordered_map<uint64_t, uint32_t> heat;
+  // Unlinked direct jumps waiting for a block at their target
+  std::unordered_map<uint64_t, std::vector<size_t>> pendingLinks;
+
+  explicit JIT(CPU &cpu);
+  ~JIT();
+  JIT(const JIT &) = delete;
+  JIT &operator=(const JIT &) = delete;
+
+  static bool supported(void);
+
+  // Same contract as CPU::run
+  StopReason run(const uint64_t budget);
+
+  void invalidate(void);
+  // Safe from other threads, the running chain of blocks exits at its next
+  // block entry
+  void preempt(void);
+  void flush(void);
+  bool setExecutable(const bool executable);
+  static uint64_t blockKey(const uint64_t ip, const uint32_t physicalAddress, const bool paging);
+  const uint8_t *blockAt(const uint64_t ip);
+  const uint8_t *compile(const uint32_t physicalAddress, const uint64_t ip);
+};
@@ -0,0 +1,64 @@
+#include "machine.hpp"
+#include "jit.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+Machine::Machine(const CPU::State &initial, const size_t memSize, const size_t nHarts)
+  : memory{std::make_shared<GuestMemory>(memSize)}, bus{std::make_shared<Bus>()} {
+  for(size_t i{0}; i < nHarts; i++){
+    CPU::State s{initial};
+    s.registers[Reg::A] = i;
+
+    auto &hart = harts.emplace_back(std::make_unique<CPU>(s, memory));
+    hart->bus = bus;
+    hart->machine = this;
+    hart->sharedMemory = nHarts > 1;
+  }
+}
+
+// The last hart runs on the calling thread
+void Machine::forEachHart(const std::function<void(CPU &, size_t)> &f){
+  if(harts.empty()){
+    return;
+  }
+
+  std::vector<std::jthread> threads;
+  threads.reserve(harts.size() - 1);
+
+  for(size_t i{0}; i + 1 < harts.size(); i++){
+    threads.emplace_back([&f, this, i]{ f(*harts[i], i); });
+  }
+  f(*harts.back(), harts.size() - 1);
+}
+
+std::vector<StopReason> Machine::run(const uint64_t budget){
+  std::vector<StopReason> reasons(harts.size());
+
+  forEachHart([&](CPU &hart, const size_t index){
+    reasons[index] = hart.run(budget);
+  });
+
+  return reasons;
+}
+
+// Flag first, so a hart that sees the cleared tag or shortened limit also
+// sees the flag. The fence pairs with the one in CPU::fetchInstSlow.
+void Machine::invalidateDecoded(CPU &writer, const uint32_t physicalAddress, const uint64_t nBytes){
+  writer.invalidateDecoded(physicalAddress, nBytes);
+
+  for(const auto &hart : harts){
+    if(hart.get() == &writer){
+      continue;
+    }
+    hart->codeStale.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    hart->fetchTag.store(UINT64_MAX, std::memory_order_relaxed);
+    if(hart->jit){
+      hart->jit->preempt();
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "src/emulator/bus.hpp"
+#include "src/emulator/cpu.hpp"
+#include "src/emulator/memory.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Most host threads the front ends start, as harts or batch workers. Each
+// gets a host stack and, with --jit, a 16MiB code buffer, so far more than
+// any host has cores only exhausts memory and thread limits. A mistyped
+// count is refused instead.
+inline constexpr size_t maxHostThreads = 1024;
+
+// Harts sharing one guest memory, each run on its own host thread.
+//
+// Memory model seen by the guest:
+// - Aligned 1, 2, 4 and 8 byte accesses are single-copy atomic, unaligned
+//   accesses may tear.
+// - Loads acquire and stores release, so a hart that loads a value stored by
+//   another hart also sees every store that hart made before it. A store may
+//   still be reordered after a later load of a different address (like x86).
+// - Instruction fetch and the TLB are not coherent with other harts. Code or
+//   page tables written by another hart are only guaranteed to be seen after
+//   a PMOV to EFLAGS or RPT, which drops the hart's TLB and decoded code.
+//   Device DMA is the exception, see invalidateDecoded.
+// - CAS and FADD are sequentially consistent read-modify-writes, all harts
+//   see them in one order and they also order the accesses around them.
+// - Accessed and modified page table bits are plain read-modify-writes and
+//   may lose a race with another hart updating the same entry.
+struct Machine {
+  std::shared_ptr<GuestMemory> memory;
+  std::shared_ptr<Bus> bus;
+  std::vector<std::unique_ptr<CPU>> harts;
+
+  // Every hart starts from initial with A holding its hart index
+  Machine(const CPU::State &initial, const size_t memSize, const size_t nHarts);
+
+  // Calls f(hart, index) for every hart on its own thread, returns once all have
+  void forEachHart(const std::function<void(CPU &, size_t)> &f);
+  // Runs each hart for up to budget instructions
+  std::vector<StopReason> run(const uint64_t budget);
+
+  // Code rewritten behind the harts' backs, e.g. by DMA. writer drops its
+  // decoded copy at once. The others may be running, so they are flagged and
+  // drop all decoded code and JIT blocks before their next fetch or block.
+  void invalidateDecoded(CPU &writer, const uint32_t physicalAddress, const uint64_t nBytes);
+};
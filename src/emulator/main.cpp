@@ -1,6 +1,321 @@
-#include <iostream>
 #include "src/emulator/cpu.hpp"
+#include "src/emulator/devices.hpp"
+#include "src/emulator/jit.hpp"
+#include "src/emulator/machine.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string stopReasonName(const StopReason reason){
+  switch(reason){
+    case StopReason::BUDGET_EXHAUSTED:
+      return "budget exhausted";
+    case StopReason::HALT:
+      return "halt";
+    case StopReason::DOUBLE_FAULT:
+      return "double fault";
+    case StopReason::BREAKPOINT:
+      return "breakpoint";
+  }
+  return "unknown";
+}
+
+// Set by SIGUSR1, the trace watcher thread does the actual writing
+static std::atomic<bool> traceRequested{false};
+
+[[maybe_unused]] static void requestTrace(int){
+  traceRequested.store(true);
+}
+
+int main(int argc, char *argv[]){
+  const std::filesystem::path thisExecutable(argv[0]);
+  const std::string usage = "Usage: " + thisExecutable.filename().string() + " [flags] image.bin\n"
+                            "Use --help flag for further information\n";
+  const std::string help = "Flags:\n"
+                           "-m [memsize]: Set the guest memory size in bytes (default 8MiB)\n"
+                           "-n [count]: Stop after executing count instructions\n"
+                           "-c [harts]: Run harts cores over shared memory, each starts at 0 with A = its index\n"
+                           "-d [path]: Attach path as the block device, read only if it is not writable\n"
+                           "--resume: Continue past breakpoints instead of stopping\n"
+                           "--jit: Compile hot code to native instructions (x86-64 only)\n"
+                           "--profile [path]: Write instruction counts per address as folded stacks and print\n"
+                           "                  totals per opcode (builds configured with -DIDEALVM_PROFILE=ON)\n"
+                           "--symbols [path]: Debug map written by the assembler's -m flag, names --profile\n"
+                           "                  addresses (default: the image path with .map)\n"
+                           "--trace [path]: Record the last instructions of every hart and write them to path\n"
+                           "                on a double fault or SIGUSR1, decode with tracedump\n"
+                           "--trace-size [records]: Instructions kept per hart by --trace (default 4096)\n";
+
+  std::vector<std::string> positionalArguments{};
+  std::size_t memorySize{0x800000};
+  uint64_t budget{UINT64_MAX};
+  std::size_t nHarts{1};
+  bool resumeBreakpoints{false};
+  bool useJit{false};
+  std::optional<std::filesystem::path> diskPath{};
+  std::optional<std::filesystem::path> profilePath{};
+  std::optional<std::filesystem::path> symbolsPath{};
+  std::optional<std::filesystem::path> tracePath{};
+  uint64_t traceRecords{4096};
+
+  for(int i{1}; i < argc; i++){
+    const std::string arg = argv[i];
+    const bool hasNext = i+1 < argc;
+
+    if(arg == "-d" || arg == "--profile" || arg == "--symbols" || arg == "--trace"){
+      if(!hasNext){
+        std::cerr << usage << arg << ": No value provided\n";
+        return EXIT_FAILURE;
+      }
+
+      const std::filesystem::path path = argv[++i];
+
+      if(arg == "-d"){
+        diskPath = path;
+      }
+      else if(arg == "--profile"){
+#ifndef IDEALVM_PROFILE
+        std::cerr << usage << "--profile: Not compiled in, configure with -DIDEALVM_PROFILE=ON\n";
+        return EXIT_FAILURE;
+#endif
+        profilePath = path;
+      }
+      else if(arg == "--trace"){
+        tracePath = path;
+      }
+      else{
+        symbolsPath = path;
+      }
+    }
+    else if(arg == "-m" || arg == "-n" || arg == "-c" || arg == "--trace-size"){
+      if(!hasNext){
+        std::cerr << usage << arg << ": No value provided\n";
+        return EXIT_FAILURE;
+      }
+
+      std::optional<uint64_t> value{};
+      try{
+        value = std::stoull(argv[++i], nullptr, 0);
+      }
+      catch(...){
+      }
+
+      if(!value || value == 0){
+        std::cerr << usage << arg << ": Value must be a positive integer\n";
+        return EXIT_FAILURE;
+      }
+
+      if(arg == "-m"){
+        if(value > 0x100000000){
+          std::cerr << usage << "-m: Memory size must be at most 4GiB\n";
+          return EXIT_FAILURE;
+        }
+        memorySize = value.value();
+      }
+      else if(arg == "-c"){
+        if(value > maxHostThreads){
+          std::cerr << usage << "-c: At most " << maxHostThreads << " harts are supported\n";
+          return EXIT_FAILURE;
+        }
+        nHarts = value.value();
+      }
+      else if(arg == "--trace-size"){
+        if(value > 0x10000000){
+          std::cerr << usage << "--trace-size: At most 2^28 records per hart are supported\n";
+          return EXIT_FAILURE;
+        }
+        traceRecords = value.value();
+      }
+      else{
+        budget = value.value();
+      }
+    }
+    else if(arg == "--resume"){
+      resumeBreakpoints = true;
+    }
+    else if(arg == "--jit"){
+      useJit = true;
+    }
+    else if(arg == "--help"){
+      std::cout << help;
+      return EXIT_SUCCESS;
+    }
+    else{
+      positionalArguments.push_back(argv[i]);
+    }
+  }
+
+  if(positionalArguments.size() < 1){
+    std::cerr << usage;
+    return EXIT_FAILURE;
+  }
+
+  std::filesystem::path imagePath{};
+
+  try{
+    imagePath = positionalArguments[0];
+    if(!std::filesystem::is_regular_file(imagePath))
+      throw std::invalid_argument("Not a regular file");
+  }
+  catch(...){
+    std::cerr << "Invalid image file: " + positionalArguments[0] + "\n";
+    return EXIT_FAILURE;
+  }
+
+  const auto imageSize = std::filesystem::file_size(imagePath);
+
+  if(imageSize > memorySize){
+    std::cerr << "Image of " << imageSize << " bytes does not fit in " << memorySize << " bytes of memory\n";
+    return EXIT_FAILURE;
+  }
+
+  // Images are flat and start executing at address 0, mapped rather than
+  // copied so untouched parts of the image and RAM are never read in
+  Machine machine(CPU::State{}, memorySize, nHarts);
+
+  if(!machine.memory->mapImage(imagePath)){
+    std::cerr << "Error reading image file: " + positionalArguments[0] + "\n";
+    return EXIT_FAILURE;
+  }
+
+  auto console = std::make_shared<ConsoleDevice>();
+  machine.bus->attach(MMIO::CONSOLE, MMIO::REGION_SIZE, console);
+  machine.bus->attach(MMIO::TIMER, MMIO::REGION_SIZE, std::make_shared<TimerDevice>());
+
+  if(diskPath){
+    auto disk = std::make_shared<BlockDevice>();
+    if(!disk->open(diskPath.value())){
+      std::cerr << "Error opening block device: " << diskPath.value().string() << "\n";
+      return EXIT_FAILURE;
+    }
+    machine.bus->attach(MMIO::BLOCK, MMIO::REGION_SIZE, disk);
+  }
+
+  if(useJit && !JIT::supported()){
+    std::cerr << "--jit: Not supported on this host, interpreting instead\n";
+    useJit = false;
+  }
+
+  std::vector<std::unique_ptr<JIT>> jits(nHarts);
+  if(useJit){
+    for(std::size_t i{0}; i < nHarts; i++){
+      jits[i] = std::make_unique<JIT>(*machine.harts[i]);
+    }
+  }
+
+  // Written while the other harts keep running, their rings are read lock free
+  std::mutex traceLock{};
+  auto writeTraces = [&]{
+    const std::scoped_lock guard{traceLock};
+    std::ofstream traceFile(tracePath.value(), std::ios::binary);
+    for(std::size_t i{0}; i < nHarts; i++){
+      writeTrace(traceFile, *machine.harts[i]->trace, i);
+    }
+    if(!traceFile){
+      std::cerr << "Error writing trace: " << tracePath.value().string() << "\n";
+    }
+  };
+
+  std::jthread traceWatcher{};
+  if(tracePath){
+    for(const auto &hart : machine.harts){
+      hart->trace = std::make_unique<TraceRing>(traceRecords);
+    }
+
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, requestTrace);
+    traceWatcher = std::jthread([&](const std::stop_token stop){
+      while(!stop.stop_requested()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if(traceRequested.exchange(false)){
+          writeTraces();
+        }
+      }
+    });
+#endif
+  }
+
+  std::vector<StopReason> reasons(nHarts);
+
+  machine.forEachHart([&](CPU &cpu, const std::size_t index){
+    JIT *jit = jits[index].get();
+    StopReason reason{};
+    uint64_t remaining = budget;
+
+    do{
+      reason = jit ? jit->run(remaining) : cpu.run(remaining);
+      remaining = budget - cpu.retired;
+    } while(reason == StopReason::BREAKPOINT && resumeBreakpoints && remaining);
+
+    if(reason == StopReason::DOUBLE_FAULT && tracePath){
+      writeTraces();
+    }
+    reasons[index] = reason;
+  });
+
+  if(traceWatcher.joinable()){
+    traceWatcher.request_stop();
+    traceWatcher.join();
+  }
+
+  // Guest output goes out before the host's own report
+  console->flush();
+
+#ifdef IDEALVM_PROFILE
+  if(profilePath){
+    Profile total{};
+    uint64_t pageWalks{0};
+    for(const auto &hart : machine.harts){
+      total.merge(hart->profile);
+      pageWalks += hart->pageWalks;
+    }
+
+    DebugMap debug{};
+    const auto mapPath = symbolsPath.value_or(std::filesystem::path(imagePath).replace_extension(".map"));
+    if(!debug.load(mapPath) && symbolsPath){
+      std::cerr << "Failed to load debug map: " << mapPath.string() << "\n";
+    }
+
+    std::ofstream profileFile(profilePath.value());
+    writeFoldedProfile(profileFile, total, debug);
+    if(!profileFile){
+      std::cerr << "Error writing profile: " << profilePath.value().string() << "\n";
+    }
+    writeProfileSummary(std::cerr, total, pageWalks);
+  }
+#endif
+
+  bool doubleFaulted{false};
+
+  for(std::size_t i{0}; i < nHarts; i++){
+    const CPU &cpu = *machine.harts[i];
+
+    if(nHarts > 1){
+      std::cout << std::dec << "Hart " << i << ":\n";
+    }
+
+    std::cout << "Stopped: " << stopReasonName(reasons[i]) << " after " << std::dec << cpu.retired << " instructions\n";
+    std::cout << "ip: 0x" << std::hex << cpu.st.ip << "\n";
+
+    for(int r{0}; r < 16; r++){
+      std::cout << "r" << std::dec << r << ": 0x" << std::hex << cpu.st.registers[r] << "\n";
+    }
+
+    doubleFaulted |= reasons[i] == StopReason::DOUBLE_FAULT;
+  }
 
-int main(){
-	std::cout << "Hello, World!\n";
+  return doubleFaulted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,396 @@
+#include "memory.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef IDEALVM_MMAP
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef IDEALVM_MMAP
+
+// Dirty tracking and file mappings work in host pages, which need not be
+// guest pages
+static size_t hostPageSize(void){
+  static const auto size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+static bool isZeroPage(const uint8_t *page, const size_t length){
+  uint64_t accumulated{0};
+  for(size_t i{0}; i + 8 <= length; i += 8){
+    uint64_t word;
+    std::memcpy(&word, page + i, 8);
+    accumulated |= word;
+  }
+  for(size_t i{length & ~size_t{7}}; i < length; i++){
+    accumulated |= page[i];
+  }
+  return accumulated == 0;
+}
+
+static int anonymousFile(void){
+#ifdef __linux__
+  const int fd = memfd_create("idealvm-snapshot", MFD_CLOEXEC);
+#else
+  std::FILE *file = std::tmpfile();
+  const int fd = file ? dup(fileno(file)) : -1;
+  if(file){
+    std::fclose(file);
+  }
+#endif
+  if(fd < 0){
+    throw std::system_error(errno, std::generic_category(), "Snapshot file");
+  }
+  return fd;
+}
+
+static void writeAll(const int fd, const uint8_t *bytes, const size_t length, const size_t offset){
+  size_t written{0};
+  while(written < length){
+    const ssize_t n = pwrite(fd, bytes + written, length - written,
+                             static_cast<off_t>(offset + written));
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      throw std::system_error(errno, std::generic_category(), "Snapshot write");
+    }
+    written += static_cast<size_t>(n);
+  }
+}
+
+// Pages the guest wrote since they were mapped. Private file pages become
+// anonymous once copied on write, and untouched anonymous pages are not
+// present, so the kernel's page map already tracks this and stores pay
+// nothing for it. Where it cannot be read every page counts as written.
+class WrittenPages {
+  int pagemap{-1};
+  std::array<uint64_t, 512> entries{};
+  size_t firstEntry{SIZE_MAX};
+  uintptr_t basePage;
+
+public:
+  explicit WrittenPages(const uint8_t *bytes)
+    : basePage{reinterpret_cast<uintptr_t>(bytes) / hostPageSize()} {
+#ifdef __linux__
+    pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+#endif
+  }
+  ~WrittenPages(){
+    if(pagemap >= 0){
+      close(pagemap);
+    }
+  }
+  WrittenPages(const WrittenPages &) = delete;
+  WrittenPages &operator=(const WrittenPages &) = delete;
+
+  // Pages must be asked for in increasing order
+  bool operator()(const size_t page){
+    if(pagemap < 0){
+      return true;
+    }
+
+    if(page < firstEntry || page >= firstEntry + entries.size()){
+      firstEntry = page;
+      const auto offset = static_cast<off_t>((basePage + page) * sizeof(uint64_t));
+      if(pread(pagemap, entries.data(), sizeof(entries), offset) != static_cast<ssize_t>(sizeof(entries))){
+        close(pagemap);
+        pagemap = -1;
+        return true;
+      }
+    }
+
+    constexpr uint64_t present = uint64_t{1} << 63;
+    constexpr uint64_t swapped = uint64_t{1} << 62;
+    constexpr uint64_t filePage = uint64_t{1} << 61;
+    const uint64_t entry = entries[page - firstEntry];
+    return (entry & swapped) || (entry & (present | filePage)) == present;
+  }
+};
+
+// Runs of above replace whatever below has under them
+static std::vector<BackingRun> overlay(const std::vector<BackingRun> &below,
+                                      const std::vector<BackingRun> &above){
+  std::vector<BackingRun> result;
+  auto cover = above.begin();
+
+  for(const BackingRun &run : below){
+    size_t first = run.first;
+    const size_t end = run.first + run.count;
+
+    while(cover != above.end() && cover->first + cover->count <= first){
+      cover++;
+    }
+    for(auto piece = cover; piece != above.end() && piece->first < end; piece++){
+      if(piece->first > first){
+        result.push_back(BackingRun{first, piece->first - first, run.file});
+      }
+      first = std::max(first, piece->first + piece->count);
+    }
+    if(first < end){
+      result.push_back(BackingRun{first, end - first, run.file});
+    }
+  }
+
+  result.insert(result.end(), above.begin(), above.end());
+  std::ranges::sort(result, {}, &BackingRun::first);
+  return result;
+}
+
+BackingFile::~BackingFile(){
+  if(fd >= 0){
+    close(fd);
+  }
+}
+
+GuestMemory::GuestMemory(const size_t length) : length{length} {
+  if(length == 0){
+    return;
+  }
+
+  // Untouched pages cost nothing, so large guests start instantly
+  map({});
+}
+
+// Private file mappings are copy-on-write, and keep their file alive after
+// the snapshot is destroyed
+GuestMemory::GuestMemory(const MemorySnapshot &snapshot) : length{snapshot.length} {
+  if(length == 0){
+    return;
+  }
+
+  map(snapshot.runs);
+}
+
+// Zero pages with every run mapped over them, replacing the old mapping in
+// place so dirty pages are simply dropped
+void GuestMemory::map(std::vector<BackingRun> layout){
+  const int fixed = bytes ? MAP_FIXED : 0;
+  void *mapping = mmap(bytes, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | fixed, -1, 0);
+  if(mapping == MAP_FAILED){
+    throw std::bad_alloc();
+  }
+  bytes = static_cast<uint8_t *>(mapping);
+
+  const size_t hostPage = hostPageSize();
+  for(const BackingRun &run : layout){
+    const size_t offset = run.first * hostPage;
+    mapping = mmap(bytes + offset, std::min(run.count * hostPage, length - offset),
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED,
+                   run.file->fd, static_cast<off_t>(offset));
+    if(mapping == MAP_FAILED){
+      throw std::bad_alloc();
+    }
+  }
+  runs = std::move(layout);
+}
+
+void GuestMemory::restore(const MemorySnapshot &snapshot){
+  if(snapshot.length != length){
+    throw std::invalid_argument("Snapshot size does not match guest memory");
+  }
+  if(length == 0){
+    return;
+  }
+
+  map(snapshot.runs);
+}
+
+void GuestMemory::release(void){
+  if(bytes){
+    munmap(bytes, length);
+  }
+}
+
+// Image pages are only read in when the guest touches them, so boot time
+// does not depend on the image size
+bool GuestMemory::mapImage(const std::filesystem::path &path){
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    return false;
+  }
+  auto image = std::make_shared<const BackingFile>(fd);
+
+  struct stat info{};
+  if(fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) > length){
+    return false;
+  }
+
+  const auto imageSize = static_cast<size_t>(info.st_size);
+  if(imageSize == 0){
+    return true;
+  }
+
+  // The tail of the last page past the end of the file reads as zero
+  const size_t hostPage = hostPageSize();
+  const size_t imagePages = (imageSize + hostPage - 1) / hostPage;
+
+  void *mapping = mmap(bytes, imagePages * hostPage, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fd, 0);
+  if(mapping == MAP_FAILED){
+    return false;
+  }
+
+  // Snapshots keep mapping the image instead of copying it
+  runs = overlay(runs, {BackingRun{0, imagePages, std::move(image)}});
+  return true;
+}
+
+// Only pages written since they were mapped can differ from what runs map,
+// written pages outside every run are skipped if they are still zero
+MemorySnapshot GuestMemory::snapshot(void){
+  if(length == 0){
+    return MemorySnapshot{length, runs};
+  }
+
+  const size_t hostPage = hostPageSize();
+  const size_t nPages = (length + hostPage - 1) / hostPage;
+  WrittenPages written(bytes);
+  std::vector<BackingRun> changed;
+  std::vector<BackingRun> zero;
+  auto below = runs.begin();
+
+  const auto add = [](std::vector<BackingRun> &pages, const size_t page){
+    if(!pages.empty() && pages.back().first + pages.back().count == page){
+      pages.back().count++;
+    }
+    else{
+      pages.push_back(BackingRun{page, 1, nullptr});
+    }
+  };
+
+  for(size_t page{0}; page < nPages; page++){
+    if(!written(page)){
+      continue;
+    }
+
+    while(below != runs.end() && below->first + below->count <= page){
+      below++;
+    }
+    const bool backed = below != runs.end() && below->first <= page;
+    const size_t offset = page * hostPage;
+    if(!backed && isZeroPage(bytes + offset, std::min(hostPage, length - offset))){
+      add(zero, page);
+      continue;
+    }
+    add(changed, page);
+  }
+
+#ifdef __linux__
+  // Reading zero memory maps the shared zero page, which looks written.
+  // Dropped, the next snapshot does not scan them again.
+  for(const BackingRun &run : zero){
+    madvise(bytes + run.first * hostPage, run.count * hostPage, MADV_DONTNEED);
+  }
+#endif
+
+  if(changed.empty()){
+    return MemorySnapshot{length, runs};
+  }
+
+  const int fd = anonymousFile();
+  auto file = std::make_shared<const BackingFile>(fd);
+  if(ftruncate(fd, static_cast<off_t>(length)) != 0){
+    throw std::system_error(errno, std::generic_category(), "Snapshot file");
+  }
+
+  for(BackingRun &run : changed){
+    const size_t offset = run.first * hostPage;
+    const size_t size = std::min(run.count * hostPage, length - offset);
+    writeAll(fd, bytes + offset, size, offset);
+    run.file = file;
+
+    // Same contents, but clean again for the next snapshot
+    void *mapping = mmap(bytes + offset, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, fd, static_cast<off_t>(offset));
+    if(mapping == MAP_FAILED){
+      throw std::bad_alloc();
+    }
+  }
+
+  runs = overlay(runs, changed);
+  return MemorySnapshot{length, runs};
+}
+
+#else
+
+GuestMemory::GuestMemory(const size_t length) : length{length} {
+  if(length){
+    bytes = new uint8_t[length]{};
+  }
+}
+
+GuestMemory::GuestMemory(const MemorySnapshot &snapshot) : GuestMemory(snapshot.length) {
+  std::memcpy(bytes, snapshot.contents.data(), length);
+}
+
+void GuestMemory::restore(const MemorySnapshot &snapshot){
+  if(snapshot.length != length){
+    throw std::invalid_argument("Snapshot size does not match guest memory");
+  }
+  std::memcpy(bytes, snapshot.contents.data(), length);
+}
+
+void GuestMemory::release(void){
+  delete[] bytes;
+}
+
+bool GuestMemory::mapImage(const std::filesystem::path &path){
+  std::error_code error;
+  const auto imageSize = std::filesystem::file_size(path, error);
+  if(error || imageSize > length){
+    return false;
+  }
+
+  std::ifstream image(path, std::ios::binary);
+  image.read(reinterpret_cast<char *>(bytes), static_cast<std::streamsize>(imageSize));
+  return static_cast<bool>(image);
+}
+
+MemorySnapshot GuestMemory::snapshot(void){
+  return MemorySnapshot{length, std::vector<uint8_t>(bytes, bytes + length)};
+}
+
+#endif
+
+GuestMemory::~GuestMemory(){
+  release();
+}
+
+GuestMemory::GuestMemory(GuestMemory &&other) noexcept
+  : bytes{std::exchange(other.bytes, nullptr)}, length{std::exchange(other.length, 0)}
+#ifdef IDEALVM_MMAP
+  , runs{std::move(other.runs)}
+#endif
+{}
+
+GuestMemory &GuestMemory::operator=(GuestMemory &&other) noexcept{
+  if(this != &other){
+    release();
+    bytes = std::exchange(other.bytes, nullptr);
+    length = std::exchange(other.length, 0);
+#ifdef IDEALVM_MMAP
+    runs = std::move(other.runs);
+#endif
+  }
+  return *this;
+}
+
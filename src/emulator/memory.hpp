@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+// Page backed guest memory only exists on POSIX hosts, elsewhere memory is
+// a heap allocation and snapshots are full copies
+#if defined(__unix__) || defined(__APPLE__)
+#define IDEALVM_MMAP
+#endif
+
+#ifdef IDEALVM_MMAP
+// Open file holding guest pages at their physical addresses, closed once no
+// snapshot or guest maps it anymore
+struct BackingFile {
+  int fd{-1};
+
+  explicit BackingFile(const int fd) : fd{fd} {}
+  ~BackingFile();
+  BackingFile(const BackingFile &) = delete;
+  BackingFile &operator=(const BackingFile &) = delete;
+};
+
+// Host pages [first, first + count) of guest memory come from file
+struct BackingRun {
+  size_t first;
+  size_t count;
+  std::shared_ptr<const BackingFile> file;
+};
+#endif
+
+// Immutable copy of guest memory. Runs of pages stay in the files they were
+// first written to, so any number of GuestMemory instances can map them
+// copy-on-write and a snapshot only adds the pages written since the last.
+struct MemorySnapshot {
+  size_t length{0};
+#ifdef IDEALVM_MMAP
+  std::vector<BackingRun> runs; // Sorted and disjoint, other pages are zero
+#else
+  std::vector<uint8_t> contents;
+#endif
+};
+
+// Guest physical memory. Fresh memory is zero filled on first touch, memory
+// made from a snapshot only copies the pages the guest writes.
+struct GuestMemory {
+  uint8_t *bytes{nullptr};
+  size_t length{0};
+
+  explicit GuestMemory(const size_t length);
+  explicit GuestMemory(const MemorySnapshot &snapshot);
+  ~GuestMemory();
+  GuestMemory(GuestMemory &&other) noexcept;
+  GuestMemory &operator=(GuestMemory &&other) noexcept;
+  GuestMemory(const GuestMemory &) = delete;
+  GuestMemory &operator=(const GuestMemory &) = delete;
+
+  uint8_t *data(void) { return bytes; }
+  const uint8_t *data(void) const { return bytes; }
+  size_t size(void) const { return length; }
+  uint8_t &operator[](const size_t i) { return bytes[i]; }
+  const uint8_t &operator[](const size_t i) const { return bytes[i]; }
+
+  // Maps an image file copy-on-write at physical address 0, the file is
+  // never written. Must happen before the guest runs as decoded pages are
+  // not invalidated. False if it cannot be read or does not fit.
+  bool mapImage(const std::filesystem::path &path);
+
+  // Writes the pages changed since the image, the last snapshot or restore
+  // to a new file and maps them back from it, so the next snapshot only pays
+  // for pages written after this one. No hart may run meanwhile.
+  MemorySnapshot snapshot(void);
+  // Discards every page written since and maps the snapshot in its place,
+  // sizes must match
+  void restore(const MemorySnapshot &snapshot);
+
+private:
+#ifdef IDEALVM_MMAP
+  std::vector<BackingRun> runs; // What is mapped under the written pages
+
+  void map(std::vector<BackingRun> layout);
+#endif
+  void release(void);
+};
@@ -0,0 +1,71 @@
+#include "profile.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <ios>
+#include <numeric>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+void Profile::merge(const Profile &other){
+  for(size_t i{0}; i < opcodes.size(); i++){
+    opcodes[i] += other.opcodes[i];
+    interrupts[i] += other.interrupts[i];
+  }
+
+  for(const auto &[address, count] : other.addresses){
+    addresses[address] += count;
+  }
+}
+
+// Unresolved addresses are grouped under the name perf uses
+void writeFoldedProfile(std::ostream &out, const Profile &profile, const DebugMap &debug){
+  std::vector<std::pair<uint64_t, uint64_t>> sorted(profile.addresses.begin(), profile.addresses.end());
+  std::sort(sorted.begin(), sorted.end());
+
+  for(const auto &[address, count] : sorted){
+    const DebugMapSymbol *symbol = debug.symbol(address);
+    const auto line = debug.line(address);
+
+    out << (symbol ? debug.name(*symbol) : "[unknown]") << ";";
+    if(line){
+      out << debug.source() << ":" << std::dec << line.value();
+    }
+    else{
+      out << "0x" << std::hex << address;
+    }
+    out << " " << std::dec << count << "\n";
+  }
+}
+
+void writeProfileSummary(std::ostream &out, const Profile &profile, const uint64_t pageWalks){
+  const uint64_t total = std::accumulate(profile.opcodes.begin(), profile.opcodes.end(), uint64_t{0});
+
+  // Indices of non-zero counts, busiest first
+  auto ranked = [](const std::array<uint64_t, 256> &counts){
+    std::vector<size_t> order{};
+    for(size_t i{0}; i < counts.size(); i++){
+      if(counts[i]){
+        order.push_back(i);
+      }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const size_t a, const size_t b){
+      return counts[a] > counts[b];
+    });
+    return order;
+  };
+
+  out << std::dec << "Instructions: " << total << "\n"
+      << "Page walks: " << pageWalks << "\n"
+      << "Opcodes:\n";
+
+  for(const size_t op : ranked(profile.opcodes)){
+    out << "  " << opName(op) << " " << profile.opcodes[op] << "\n";
+  }
+
+  out << "Interrupts:\n";
+  for(const size_t code : ranked(profile.interrupts)){
+    out << "  0x" << std::hex << code << std::dec << " " << profile.interrupts[code] << "\n";
+  }
+}
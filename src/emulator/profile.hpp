@@ -0,0 +1,25 @@
+#pragma once
+
+#include "src/emulator/debugmap.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+
+// Execution counts of a CPU. Only collected in builds configured with
+// -DIDEALVM_PROFILE=ON, otherwise the run loop carries no trace of it.
+// The JIT is disabled in those builds so every instruction is seen.
+struct Profile {
+  std::array<uint64_t, 256> opcodes{};    // Instructions executed per opcode
+  std::array<uint64_t, 256> interrupts{}; // Interrupts delivered per IntCode
+  std::unordered_map<uint64_t, uint64_t> addresses{}; // Instructions executed per ip
+
+  void merge(const Profile &other);
+};
+
+// One "symbol;file:line count" line per executed address, the folded stack
+// format read by flamegraph.pl and similar tools. Addresses without a source
+// line are written as hex.
+void writeFoldedProfile(std::ostream &out, const Profile &profile, const DebugMap &debug);
+// Totals per opcode and interrupt, busiest first
+void writeProfileSummary(std::ostream &out, const Profile &profile, const uint64_t pageWalks);
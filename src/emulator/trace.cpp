@@ -0,0 +1,52 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+TraceRing::TraceRing(const size_t capacity)
+  : records{std::make_unique<TraceRecord[]>(std::bit_ceil(std::max<size_t>(capacity, 1)))},
+    mask{std::bit_ceil(std::max<size_t>(capacity, 1)) - 1} {}
+
+// Like a seqlock read: copy, then check how far the writer got meanwhile.
+// The record being written when head was reread shares its slot with the
+// oldest one, so that one is dropped too.
+std::vector<TraceRecord> TraceRing::snapshot(uint64_t &first) const{
+  const uint64_t end = head.load(std::memory_order_acquire);
+  const uint64_t capacity = mask + 1;
+  uint64_t start = end > capacity ? end - capacity : 0;
+
+  std::vector<TraceRecord> copy(end - start);
+  for(uint64_t i{start}; i < end; i++){
+    copy[i - start] = records[i & mask];
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t written = head.load(std::memory_order_relaxed);
+
+  if(written + 1 > start + capacity){
+    const uint64_t stale = std::min(written + 1 - capacity - start, end - start);
+    copy.erase(copy.begin(), copy.begin() + stale);
+    start += stale;
+  }
+
+  first = start;
+  return copy;
+}
+
+bool writeTrace(std::ostream &out, const TraceRing &ring, const uint32_t hart){
+  TraceHeader header{};
+  const std::vector<TraceRecord> records = ring.snapshot(header.first);
+
+  std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.hart = hart;
+  header.count = records.size();
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(TraceRecord));
+  return static_cast<bool>(out);
+}
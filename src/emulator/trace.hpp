@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace TraceFlag {
+  inline constexpr uint8_t RAISED = 0x1;      // The instruction raised code
+  inline constexpr uint8_t FETCH_FAULT = 0x2; // Nothing was executed, inst is 0
+}
+
+// One executed instruction. What each field means for a given opcode is left
+// to the decoder, recording stays the same few stores for every instruction.
+struct TraceRecord {
+  uint64_t ip;
+  uint64_t operand; // r1 + offset before executing, the address of loads and stores
+  uint64_t result;  // r0 after executing, the register most instructions write
+  uint32_t inst;    // Instruction word
+  uint8_t flags;    // See TraceFlag
+  uint8_t code;     // IntCode, only set with RAISED
+  uint16_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 32);
+
+// The last records executed by one hart. The hart is the only writer and
+// publishes each record with a release store of head, so other threads can
+// take a snapshot while it runs without slowing it down.
+struct TraceRing {
+  std::unique_ptr<TraceRecord[]> records;
+  uint64_t mask; // Capacity - 1
+  std::atomic<uint64_t> head{0}; // Records written since creation
+
+  // Rounded up to a power of two
+  explicit TraceRing(const size_t capacity);
+
+  TraceRecord &next(void){
+    return records[head.load(std::memory_order_relaxed) & mask];
+  }
+  void publish(void){
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Oldest first, records the writer overwrote while copying are dropped.
+  // first is set to the index of the first record returned.
+  std::vector<TraceRecord> snapshot(uint64_t &first) const;
+};
+
+// Trace dump, a section per hart. Each section is this header followed by
+// count records, oldest first, in the byte order of the host that wrote it.
+inline constexpr char TRACE_MAGIC[8] = {'I', 'V', 'M', 'T', 'R', 'C', '0', '1'};
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t hart;
+  uint32_t count;
+  uint64_t first; // Index of the first record since the hart started tracing
+};
+
+bool writeTrace(std::ostream &out, const TraceRing &ring, const uint32_t hart);
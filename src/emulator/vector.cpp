@@ -0,0 +1,317 @@
+#include "src/emulator/vector.hpp"
+#include <bit>
+#include <cstring>
+#include <type_traits>
+
+#ifdef IDEALVM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+template<uint8_t width>
+using LaneWord = std::conditional_t<width == 0, uint8_t,
+                 std::conditional_t<width == 1, uint16_t,
+                 std::conditional_t<width == 2, uint32_t, uint64_t>>>;
+
+template<typename T>
+T loadLane(const Vector &v, const uint32_t i){
+  T value;
+  std::memcpy(&value, v.bytes + i*sizeof(T), sizeof(T));
+  if constexpr(std::endian::native == std::endian::big){
+    value = std::byteswap(value);
+  }
+  return value;
+}
+
+template<typename T>
+void storeLane(Vector &v, const uint32_t i, T value){
+  if constexpr(std::endian::native == std::endian::big){
+    value = std::byteswap(value);
+  }
+  std::memcpy(v.bytes + i*sizeof(T), &value, sizeof(T));
+}
+
+// One lane at a time, the reference the SIMD kernels must match
+template<LaneOp op, uint8_t width>
+void scalarKernel(Vector &d, const Vector &s, const uint64_t amount){
+  using T = LaneWord<width>;
+  using S = std::make_signed_t<T>;
+  constexpr uint64_t bits = 8u << width;
+
+  for(uint32_t i{0}; i < sizeof(Vector) / sizeof(T); i++){
+    const T a = loadLane<T>(d, i);
+    const T b = loadLane<T>(s, i);
+    T result{};
+
+    if constexpr(op == LaneOp::ADD){
+      result = static_cast<T>(a + b);
+    }
+    else if constexpr(op == LaneOp::SUB){
+      result = static_cast<T>(a - b);
+    }
+    else if constexpr(op == LaneOp::AND){
+      result = a & b;
+    }
+    else if constexpr(op == LaneOp::OR){
+      result = a | b;
+    }
+    else if constexpr(op == LaneOp::XOR){
+      result = a ^ b;
+    }
+    else if constexpr(op == LaneOp::SHL){
+      result = amount < bits ? static_cast<T>(b << amount) : T{};
+    }
+    else if constexpr(op == LaneOp::SHR){
+      result = amount < bits ? static_cast<T>(b >> amount) : T{};
+    }
+    else if constexpr(op == LaneOp::CEQ){
+      result = a == b ? static_cast<T>(~T{}) : T{};
+    }
+    else if constexpr(op == LaneOp::CGT){
+      result = static_cast<S>(a) > static_cast<S>(b) ? static_cast<T>(~T{}) : T{};
+    }
+
+    storeLane(d, i, result);
+  }
+}
+
+#ifdef IDEALVM_X86_SIMD
+// x86 has no byte shifts, shift 16 bit lanes and clear the bits that crossed
+// into the neighbouring byte
+uint8_t byteShiftMask(const LaneOp op, const uint64_t amount){
+  if(amount >= 8){
+    return 0;
+  }
+  return op == LaneOp::SHL ? static_cast<uint8_t>(0xFF << amount) : static_cast<uint8_t>(0xFF >> amount);
+}
+
+template<LaneOp op, uint8_t width>
+[[gnu::target("avx2")]] void avx2Kernel(Vector &d, const Vector &s, const uint64_t amount){
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d.bytes));
+  const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s.bytes));
+  const __m128i count = _mm_cvtsi64_si128(static_cast<long long>(amount));
+  __m256i result;
+
+  if constexpr(op == LaneOp::ADD){
+    if constexpr(width == 0) result = _mm256_add_epi8(a, b);
+    if constexpr(width == 1) result = _mm256_add_epi16(a, b);
+    if constexpr(width == 2) result = _mm256_add_epi32(a, b);
+    if constexpr(width == 3) result = _mm256_add_epi64(a, b);
+  }
+  else if constexpr(op == LaneOp::SUB){
+    if constexpr(width == 0) result = _mm256_sub_epi8(a, b);
+    if constexpr(width == 1) result = _mm256_sub_epi16(a, b);
+    if constexpr(width == 2) result = _mm256_sub_epi32(a, b);
+    if constexpr(width == 3) result = _mm256_sub_epi64(a, b);
+  }
+  else if constexpr(op == LaneOp::AND){
+    result = _mm256_and_si256(a, b);
+  }
+  else if constexpr(op == LaneOp::OR){
+    result = _mm256_or_si256(a, b);
+  }
+  else if constexpr(op == LaneOp::XOR){
+    result = _mm256_xor_si256(a, b);
+  }
+  else if constexpr(op == LaneOp::SHL){
+    if constexpr(width == 0){
+      result = _mm256_and_si256(_mm256_sll_epi16(b, count),
+                                _mm256_set1_epi8(static_cast<char>(byteShiftMask(op, amount))));
+    }
+    if constexpr(width == 1) result = _mm256_sll_epi16(b, count);
+    if constexpr(width == 2) result = _mm256_sll_epi32(b, count);
+    if constexpr(width == 3) result = _mm256_sll_epi64(b, count);
+  }
+  else if constexpr(op == LaneOp::SHR){
+    if constexpr(width == 0){
+      result = _mm256_and_si256(_mm256_srl_epi16(b, count),
+                                _mm256_set1_epi8(static_cast<char>(byteShiftMask(op, amount))));
+    }
+    if constexpr(width == 1) result = _mm256_srl_epi16(b, count);
+    if constexpr(width == 2) result = _mm256_srl_epi32(b, count);
+    if constexpr(width == 3) result = _mm256_srl_epi64(b, count);
+  }
+  else if constexpr(op == LaneOp::CEQ){
+    if constexpr(width == 0) result = _mm256_cmpeq_epi8(a, b);
+    if constexpr(width == 1) result = _mm256_cmpeq_epi16(a, b);
+    if constexpr(width == 2) result = _mm256_cmpeq_epi32(a, b);
+    if constexpr(width == 3) result = _mm256_cmpeq_epi64(a, b);
+  }
+  else if constexpr(op == LaneOp::CGT){
+    if constexpr(width == 0) result = _mm256_cmpgt_epi8(a, b);
+    if constexpr(width == 1) result = _mm256_cmpgt_epi16(a, b);
+    if constexpr(width == 2) result = _mm256_cmpgt_epi32(a, b);
+    if constexpr(width == 3) result = _mm256_cmpgt_epi64(a, b);
+  }
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(d.bytes), result);
+}
+
+// SSE2 has everything but 64 bit signed compares, which stay scalar
+template<LaneOp op, uint8_t width>
+constexpr bool sse2Supported = !(op == LaneOp::CGT && width == 3);
+
+template<LaneOp op, uint8_t width>
+void sse2Kernel(Vector &d, const Vector &s, const uint64_t amount){
+  const __m128i count = _mm_cvtsi64_si128(static_cast<long long>(amount));
+
+  for(uint32_t half{0}; half < sizeof(Vector); half += sizeof(__m128i)){
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d.bytes + half));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.bytes + half));
+    __m128i result;
+
+    if constexpr(op == LaneOp::ADD){
+      if constexpr(width == 0) result = _mm_add_epi8(a, b);
+      if constexpr(width == 1) result = _mm_add_epi16(a, b);
+      if constexpr(width == 2) result = _mm_add_epi32(a, b);
+      if constexpr(width == 3) result = _mm_add_epi64(a, b);
+    }
+    else if constexpr(op == LaneOp::SUB){
+      if constexpr(width == 0) result = _mm_sub_epi8(a, b);
+      if constexpr(width == 1) result = _mm_sub_epi16(a, b);
+      if constexpr(width == 2) result = _mm_sub_epi32(a, b);
+      if constexpr(width == 3) result = _mm_sub_epi64(a, b);
+    }
+    else if constexpr(op == LaneOp::AND){
+      result = _mm_and_si128(a, b);
+    }
+    else if constexpr(op == LaneOp::OR){
+      result = _mm_or_si128(a, b);
+    }
+    else if constexpr(op == LaneOp::XOR){
+      result = _mm_xor_si128(a, b);
+    }
+    else if constexpr(op == LaneOp::SHL){
+      if constexpr(width == 0){
+        result = _mm_and_si128(_mm_sll_epi16(b, count),
+                               _mm_set1_epi8(static_cast<char>(byteShiftMask(op, amount))));
+      }
+      if constexpr(width == 1) result = _mm_sll_epi16(b, count);
+      if constexpr(width == 2) result = _mm_sll_epi32(b, count);
+      if constexpr(width == 3) result = _mm_sll_epi64(b, count);
+    }
+    else if constexpr(op == LaneOp::SHR){
+      if constexpr(width == 0){
+        result = _mm_and_si128(_mm_srl_epi16(b, count),
+                               _mm_set1_epi8(static_cast<char>(byteShiftMask(op, amount))));
+      }
+      if constexpr(width == 1) result = _mm_srl_epi16(b, count);
+      if constexpr(width == 2) result = _mm_srl_epi32(b, count);
+      if constexpr(width == 3) result = _mm_srl_epi64(b, count);
+    }
+    else if constexpr(op == LaneOp::CEQ){
+      if constexpr(width == 0) result = _mm_cmpeq_epi8(a, b);
+      if constexpr(width == 1) result = _mm_cmpeq_epi16(a, b);
+      if constexpr(width == 2) result = _mm_cmpeq_epi32(a, b);
+      if constexpr(width == 3){
+        // Both 32 bit halves equal
+        const __m128i equal = _mm_cmpeq_epi32(a, b);
+        result = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+      }
+    }
+    else if constexpr(op == LaneOp::CGT){
+      if constexpr(width == 0) result = _mm_cmpgt_epi8(a, b);
+      if constexpr(width == 1) result = _mm_cmpgt_epi16(a, b);
+      if constexpr(width == 2) result = _mm_cmpgt_epi32(a, b);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(d.bytes + half), result);
+  }
+}
+#endif
+
+template<LaneOp op, uint8_t width>
+LaneKernel pickKernel(const VectorBackend backend){
+#ifdef IDEALVM_X86_SIMD
+  if(backend == VectorBackend::AVX2){
+    return avx2Kernel<op, width>;
+  }
+  if constexpr(sse2Supported<op, width>){
+    if(backend == VectorBackend::SSE2){
+      return sse2Kernel<op, width>;
+    }
+  }
+#endif
+  return scalarKernel<op, width>;
+}
+
+template<LaneOp op>
+void fillKernels(LaneKernels &kernels, const VectorBackend backend){
+  kernels[static_cast<size_t>(op)] = {
+    pickKernel<op, 0>(backend), pickKernel<op, 1>(backend),
+    pickKernel<op, 2>(backend), pickKernel<op, 3>(backend),
+  };
+}
+
+}
+
+LaneKernels laneKernels(const VectorBackend backend){
+  LaneKernels kernels{};
+  fillKernels<LaneOp::ADD>(kernels, backend);
+  fillKernels<LaneOp::SUB>(kernels, backend);
+  fillKernels<LaneOp::AND>(kernels, backend);
+  fillKernels<LaneOp::OR>(kernels, backend);
+  fillKernels<LaneOp::XOR>(kernels, backend);
+  fillKernels<LaneOp::SHL>(kernels, backend);
+  fillKernels<LaneOp::SHR>(kernels, backend);
+  fillKernels<LaneOp::CEQ>(kernels, backend);
+  fillKernels<LaneOp::CGT>(kernels, backend);
+  return kernels;
+}
+
+VectorBackend hostVectorBackend(void){
+#ifdef IDEALVM_X86_SIMD
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? VectorBackend::AVX2 : VectorBackend::SSE2;
+#else
+  return VectorBackend::SCALAR;
+#endif
+}
+
+const char *vectorBackendName(const VectorBackend backend){
+  switch(backend){
+    case VectorBackend::AVX2:
+      return "avx2";
+    case VectorBackend::SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+const LaneKernels hostLaneKernels = laneKernels(hostVectorBackend());
+
+uint64_t vectorLane(const Vector &v, const uint8_t width, const uint32_t i){
+  switch(width){
+    case 0:
+      return loadLane<uint8_t>(v, i);
+    case 1:
+      return loadLane<uint16_t>(v, i);
+    case 2:
+      return loadLane<uint32_t>(v, i);
+    default:
+      return loadLane<uint64_t>(v, i);
+  }
+}
+
+void broadcastLane(Vector &v, const uint8_t width, const uint64_t value){
+  const uint32_t lanes = sizeof(Vector) >> width;
+
+  for(uint32_t i{0}; i < lanes; i++){
+    switch(width){
+      case 0:
+        storeLane(v, i, static_cast<uint8_t>(value));
+        break;
+      case 1:
+        storeLane(v, i, static_cast<uint16_t>(value));
+        break;
+      case 2:
+        storeLane(v, i, static_cast<uint32_t>(value));
+        break;
+      default:
+        storeLane(v, i, value);
+        break;
+    }
+  }
+}
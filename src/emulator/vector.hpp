@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Host SIMD is only used on x86-64, SSE2 is always there and AVX2 is picked
+// at startup when the host has it. Elsewhere lanes are done one at a time.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define IDEALVM_X86_SIMD
+#endif
+
+// One vector register, lanes in little-endian order like memory. Not over
+// aligned, State is passed by value and kernels use unaligned accesses.
+struct Vector {
+  uint8_t bytes[32];
+};
+
+inline constexpr uint32_t laneWidths = 4; // 8, 16, 32 and 64 bit lanes
+
+// Lanewise operations of the vector instructions, see Op::VADD
+enum class LaneOp : uint8_t { ADD, SUB, AND, OR, XOR, SHL, SHR, CEQ, CGT, COUNT };
+
+enum class VectorBackend : uint8_t { SCALAR, SSE2, AVX2 };
+
+// d = d op s, shifts set d = s shifted by amount
+using LaneKernel = void (*)(Vector &d, const Vector &s, const uint64_t amount);
+using LaneKernels = std::array<std::array<LaneKernel, laneWidths>,
+                               static_cast<size_t>(LaneOp::COUNT)>;
+
+// Kernels of backend, widths it has no instructions for fall back to scalar
+LaneKernels laneKernels(const VectorBackend backend);
+
+// The best backend of the host and its kernels, chosen once
+VectorBackend hostVectorBackend(void);
+const char *vectorBackendName(const VectorBackend backend);
+extern const LaneKernels hostLaneKernels;
+
+// Lane i of width (8 << width) bits, zero extended
+uint64_t vectorLane(const Vector &v, const uint8_t width, const uint32_t i);
+void broadcastLane(Vector &v, const uint8_t width, const uint64_t value);
@@ -0,0 +1,206 @@
+#include "src/emulator/machine.hpp"
+#include "src/runner/scheduler.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string statusName(const BatchResult::Status status){
+  switch(status){
+    case BatchResult::Status::HALT:
+      return "halt";
+    case BatchResult::Status::DOUBLE_FAULT:
+      return "double_fault";
+    case BatchResult::Status::BUDGET_EXHAUSTED:
+      return "budget_exhausted";
+    case BatchResult::Status::LOAD_ERROR:
+      return "load_error";
+  }
+  return "unknown";
+}
+
+static std::optional<uint64_t> parsePositive(const std::string &text){
+  std::optional<uint64_t> value{};
+  try{
+    std::size_t used{0};
+    value = std::stoull(text, &used, 0);
+    if(used != text.size()){
+      value.reset();
+    }
+  }
+  catch(...){
+  }
+
+  if(value == 0){
+    value.reset();
+  }
+  return value;
+}
+
+// One job per line: image budget [memsize], '#' starts a comment. Relative
+// image paths are relative to the manifest.
+static std::optional<std::vector<BatchJob>> parseManifest(const std::filesystem::path &path,
+                                                          const std::size_t defaultMemory){
+  std::ifstream manifest(path);
+  if(!manifest){
+    std::cerr << "Failed to open manifest: " << path.string() << "\n";
+    return std::nullopt;
+  }
+
+  std::vector<BatchJob> jobs{};
+  std::string line{};
+
+  for(std::size_t lineNumber{1}; std::getline(manifest, line); lineNumber++){
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream fields(line);
+    std::string image{}, budget{}, memory{}, extra{};
+    fields >> image >> budget >> memory >> extra;
+
+    if(image.empty()){
+      continue;
+    }
+
+    BatchJob job{};
+    job.image = path.parent_path() / image;
+    job.memorySize = defaultMemory;
+
+    const auto parsedBudget = parsePositive(budget);
+    const auto parsedMemory = memory.empty() ? std::optional<uint64_t>{defaultMemory} : parsePositive(memory);
+
+    if(!parsedBudget || !parsedMemory || *parsedMemory > 0x100000000 || !extra.empty()){
+      std::cerr << path.string() << ":" << lineNumber << ": Expected \"image budget [memsize]\"\n";
+      return std::nullopt;
+    }
+
+    job.budget = parsedBudget.value();
+    job.memorySize = parsedMemory.value();
+    jobs.push_back(job);
+  }
+
+  return jobs;
+}
+
+int main(int argc, char *argv[]){
+  const std::filesystem::path thisExecutable(argv[0]);
+  const std::string usage = "Usage: " + thisExecutable.filename().string() + " [flags] manifest\n"
+                            "Use --help flag for further information\n";
+  const std::string help = "Runs every job of a manifest, one \"image budget [memsize]\" per line,\n"
+                           "and writes a tab separated result line per job. Guest console output\n"
+                           "goes to stderr, console input is closed.\n"
+                           "Flags:\n"
+                           "-j [threads]: Worker threads (default: host cores)\n"
+                           "-q [count]: Instructions a VM runs before yielding (default 100000)\n"
+                           "-m [memsize]: Default guest memory size in bytes (default 8MiB)\n"
+                           "-o [path]: Write results to path instead of stdout\n"
+                           "--jit: Compile hot code to native instructions (x86-64 only)\n";
+
+  std::vector<std::string> positionalArguments{};
+  std::size_t nThreads = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, maxHostThreads);
+  uint64_t quantum{100'000};
+  std::size_t memorySize{0x800000};
+  std::optional<std::string> outputPath{};
+  bool useJit{false};
+
+  for(int i{1}; i < argc; i++){
+    const std::string arg = argv[i];
+    const bool hasNext = i+1 < argc;
+
+    if(arg == "-j" || arg == "-q" || arg == "-m" || arg == "-o"){
+      if(!hasNext){
+        std::cerr << usage << arg << ": No value provided\n";
+        return EXIT_FAILURE;
+      }
+
+      const std::string text = argv[++i];
+
+      if(arg == "-o"){
+        outputPath = text;
+        continue;
+      }
+
+      const auto value = parsePositive(text);
+      if(!value){
+        std::cerr << usage << arg << ": Value must be a positive integer\n";
+        return EXIT_FAILURE;
+      }
+
+      if(arg == "-j"){
+        if(value > maxHostThreads){
+          std::cerr << usage << "-j: At most " << maxHostThreads << " worker threads are supported\n";
+          return EXIT_FAILURE;
+        }
+        nThreads = value.value();
+      }
+      else if(arg == "-q"){
+        quantum = value.value();
+      }
+      else{
+        if(value > 0x100000000){
+          std::cerr << usage << "-m: Memory size must be at most 4GiB\n";
+          return EXIT_FAILURE;
+        }
+        memorySize = value.value();
+      }
+    }
+    else if(arg == "--jit"){
+      useJit = true;
+    }
+    else if(arg == "--help"){
+      std::cout << help;
+      return EXIT_SUCCESS;
+    }
+    else{
+      positionalArguments.push_back(argv[i]);
+    }
+  }
+
+  if(positionalArguments.size() < 1){
+    std::cerr << usage;
+    return EXIT_FAILURE;
+  }
+
+  const auto jobs = parseManifest(positionalArguments[0], memorySize);
+  if(!jobs){
+    return EXIT_FAILURE;
+  }
+
+  BatchRunner runner(nThreads, quantum, useJit);
+  const auto results = runner.run(jobs.value());
+
+  std::ofstream outputFile{};
+  if(outputPath){
+    outputFile.open(outputPath.value());
+    if(!outputFile){
+      std::cerr << "Failed to open output file: " << outputPath.value() << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream &output = outputPath ? outputFile : std::cout;
+
+  output << "job\timage\tstatus\tinstructions\tslices\tbreakpoints\thost_us\tip\ta\n";
+
+  bool failed{false};
+
+  for(std::size_t i{0}; i < results.size(); i++){
+    const BatchResult &result = results[i];
+
+    output << std::dec << i << "\t" << jobs.value()[i].image.string() << "\t" << statusName(result.status)
+           << "\t" << result.retired << "\t" << result.slices << "\t" << result.breakpoints
+           << "\t" << result.hostNanoseconds / 1000
+           << "\t0x" << std::hex << result.ip << "\t0x" << result.a << "\n";
+
+    failed |= result.status == BatchResult::Status::DOUBLE_FAULT ||
+              result.status == BatchResult::Status::LOAD_ERROR;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
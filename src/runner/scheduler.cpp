@@ -0,0 +1,185 @@
+#include "scheduler.hpp"
+#include "src/emulator/devices.hpp"
+#include "src/emulator/jit.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Task {
+  size_t index{};
+  uint64_t remaining{};
+  std::unique_ptr<CPU> cpu{};
+  std::unique_ptr<JIT> jit{};
+};
+
+struct WorkQueue {
+  std::mutex lock;
+  std::deque<std::unique_ptr<Task>> tasks;
+
+  std::unique_ptr<Task> popBack(void){
+    const std::scoped_lock guard{lock};
+    if(tasks.empty()){
+      return nullptr;
+    }
+    auto task = std::move(tasks.back());
+    tasks.pop_back();
+    return task;
+  }
+
+  std::unique_ptr<Task> popFront(void){
+    const std::scoped_lock guard{lock};
+    if(tasks.empty()){
+      return nullptr;
+    }
+    auto task = std::move(tasks.front());
+    tasks.pop_front();
+    return task;
+  }
+
+  // Returns how many tasks are queued now
+  size_t pushFront(std::unique_ptr<Task> task){
+    const std::scoped_lock guard{lock};
+    tasks.push_front(std::move(task));
+    return tasks.size();
+  }
+};
+
+bool load(Task &task, const BatchJob &job, const bool useJit){
+  std::error_code error;
+  if(!std::filesystem::is_regular_file(job.image, error)){
+    return false;
+  }
+
+  task.cpu = std::make_unique<CPU>(CPU::State{}, job.memorySize);
+  if(!task.cpu->memory->mapImage(job.image)){
+    task.cpu.reset();
+    return false;
+  }
+  // A console per job, so buffered output of jobs never interleaves
+  task.cpu->bus->attach(MMIO::CONSOLE, MMIO::REGION_SIZE, std::make_shared<ConsoleDevice>(2, -1));
+  task.cpu->bus->attach(MMIO::TIMER, MMIO::REGION_SIZE, std::make_shared<TimerDevice>());
+
+  if(useJit){
+    task.jit = std::make_unique<JIT>(*task.cpu);
+  }
+  return true;
+}
+
+}
+
+BatchRunner::BatchRunner(const size_t nThreads, const uint64_t quantum, const bool useJit)
+  : nThreads{std::max<size_t>(nThreads, 1)}, quantum{std::max<uint64_t>(quantum, 1)},
+    useJit{useJit && JIT::supported()} {}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob> &jobs){
+  std::vector<BatchResult> results(jobs.size());
+  std::vector<WorkQueue> queues(nThreads);
+  std::atomic<size_t> unfinished{jobs.size()};
+  // Bumped whenever a task can be stolen or the batch finishes, idle
+  // workers sleep on it
+  std::atomic<uint64_t> published{0};
+
+  for(size_t i{0}; i < jobs.size(); i++){
+    auto task = std::make_unique<Task>();
+    task->index = i;
+    task->remaining = jobs[i].budget;
+    queues[i % nThreads].tasks.push_back(std::move(task));
+  }
+
+  auto steal = [&](const size_t thief) -> std::unique_ptr<Task> {
+    for(size_t offset{1}; offset < nThreads; offset++){
+      if(auto task = queues[(thief + offset) % nThreads].popFront()){
+        return task;
+      }
+    }
+    return nullptr;
+  };
+
+  // The last job wakes every idle worker so they can return
+  auto finish = [&]{
+    if(unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1){
+      published.fetch_add(1, std::memory_order_release);
+      published.notify_all();
+    }
+  };
+
+  auto worker = [&](const size_t self){
+    while(unfinished.load(std::memory_order_acquire) > 0){
+      // Read before looking, so a task queued meanwhile cannot be missed
+      const uint64_t seen = published.load(std::memory_order_acquire);
+      std::unique_ptr<Task> task = queues[self].popBack();
+      if(!task){
+        task = steal(self);
+      }
+      // Remaining jobs are all mid-slice on other threads
+      if(!task){
+        published.wait(seen, std::memory_order_acquire);
+        continue;
+      }
+
+      const BatchJob &job = jobs[task->index];
+      BatchResult &result = results[task->index];
+
+      if(!task->cpu && !load(*task, job, useJit)){
+        result.status = BatchResult::Status::LOAD_ERROR;
+        finish();
+        continue;
+      }
+
+      CPU &cpu = *task->cpu;
+      const uint64_t slice = std::min(quantum, task->remaining);
+
+      const auto start = std::chrono::steady_clock::now();
+      const StopReason reason = task->jit ? task->jit->run(slice) : cpu.run(slice);
+      const auto end = std::chrono::steady_clock::now();
+
+      result.slices++;
+      result.hostNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      result.retired = cpu.retired;
+      result.ip = cpu.st.ip;
+      result.a = cpu.st.registers[Reg::A];
+      task->remaining = job.budget - cpu.retired;
+
+      if(reason == StopReason::BREAKPOINT){
+        result.breakpoints++;
+      }
+
+      const bool runnable = reason == StopReason::BUDGET_EXHAUSTED || reason == StopReason::BREAKPOINT;
+
+      if(runnable && task->remaining){
+        // A lone task is taken straight back by this thread, only surplus
+        // is worth waking an idle one for
+        if(queues[self].pushFront(std::move(task)) > 1){
+          published.fetch_add(1, std::memory_order_release);
+          published.notify_one();
+        }
+        continue;
+      }
+
+      result.status = reason == StopReason::HALT ? BatchResult::Status::HALT :
+                      reason == StopReason::DOUBLE_FAULT ? BatchResult::Status::DOUBLE_FAULT :
+                      BatchResult::Status::BUDGET_EXHAUSTED;
+      finish();
+    }
+  };
+
+  {
+    std::vector<std::jthread> threads;
+    threads.reserve(nThreads - 1);
+    for(size_t i{1}; i < nThreads; i++){
+      threads.emplace_back(worker, i);
+    }
+    worker(0);
+  }
+
+  return results;
+}
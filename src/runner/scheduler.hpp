@@ -0,0 +1,52 @@
+#pragma once
+
+#include "src/emulator/cpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// One guest program of a batch, started from its image at address 0
+struct BatchJob {
+  std::filesystem::path image;
+  uint64_t budget{};
+  size_t memorySize{};
+};
+
+struct BatchResult {
+  enum class Status : uint8_t {
+    HALT,
+    DOUBLE_FAULT,
+    BUDGET_EXHAUSTED,
+    LOAD_ERROR, // Image missing, unreadable or larger than memory
+  };
+
+  Status status{};
+  uint64_t retired{};     // Guest instructions executed
+  uint64_t slices{};      // Quanta the job was scheduled for
+  uint64_t breakpoints{}; // BRKs hit, batch jobs always resume past them
+  uint64_t hostNanoseconds{};
+  uint64_t ip{};
+  uint64_t a{}; // Guest return value by convention
+};
+
+// Runs every job of a batch on a pool of host threads. A VM runs for at most
+// quantum instructions before going to the back of its thread's queue, so
+// long jobs cannot starve short ones. Threads pop from the hot end of their
+// own queue and idle threads steal from the cold end of the others', or
+// sleep until another thread has a VM to spare or the batch is done. Guests
+// are only loaded once first scheduled and released once finished.
+//
+// VMs see the timer and a console of their own. Console output goes to
+// stderr, flushed when the job ends, when the console buffer fills or per
+// line if stderr is a terminal. Console input always reads as closed.
+struct BatchRunner {
+  size_t nThreads;
+  uint64_t quantum;
+  bool useJit;
+
+  BatchRunner(const size_t nThreads, const uint64_t quantum, const bool useJit);
+
+  // Results are in job order
+  std::vector<BatchResult> run(const std::vector<BatchJob> &jobs);
+};
@@ -0,0 +1,170 @@
+#include "src/emulator/cpu.hpp"
+#include "src/emulator/debugmap.hpp"
+#include "src/emulator/trace.hpp"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// "ADD r1, r15 + 0x10", operands are shown for every opcode as the trace does
+// not know which ones an instruction uses. Lane widths follow the mnemonic
+// like the assembler writes them, "VADD32".
+static void writeInstruction(std::ostream &out, const uint32_t word){
+  const uint8_t opcode = static_cast<uint8_t>(word >> 24);
+  const bool lanes = hasLaneWidth(opcode & OPCODE_MASK);
+  const Inst inst{static_cast<uint8_t>(lanes ? opcode & OPCODE_MASK : opcode),
+                  static_cast<uint8_t>((word >> 20) & 0xF), static_cast<uint8_t>((word >> 16) & 0xF),
+                  static_cast<uint8_t>(opcode >> LANE_WIDTH_SHIFT), static_cast<int16_t>(word)};
+
+  out << opName(inst.opcode);
+  if(lanes){
+    out << std::dec << (8 << inst.width);
+  }
+  out << " r" << std::dec << int{inst.r0} << ", r" << int{inst.r1};
+  if(inst.offset){
+    out << (inst.offset < 0 ? " - 0x" : " + 0x") << std::hex << std::abs(int{inst.offset});
+  }
+}
+
+static void writeRecord(std::ostream &out, const TraceRecord &record, const DebugMap &debug){
+  out << "0x" << std::hex << std::setw(8) << std::setfill('0') << record.ip << std::setfill(' ') << "  ";
+
+  if(const DebugMapSymbol *symbol = debug.symbol(record.ip)){
+    out << debug.name(*symbol);
+    if(const auto line = debug.line(record.ip)){
+      out << " " << debug.source() << ":" << std::dec << line.value();
+    }
+    out << "  ";
+  }
+
+  if(record.flags & TraceFlag::FETCH_FAULT){
+    out << "(fetch fault)";
+  }
+  else{
+    writeInstruction(out, record.inst);
+    out << "  r0=0x" << std::hex << record.result << " addr=0x" << record.operand;
+  }
+
+  if(record.flags & TraceFlag::RAISED){
+    out << "  raised 0x" << std::hex << int{record.code};
+  }
+  out << "\n";
+}
+
+// stoull skips blanks and negates a leading '-', so "-1" would wrap to the
+// largest count, only digits are taken
+static std::optional<uint64_t> parsePositive(const std::string &text){
+  std::optional<uint64_t> value{};
+  if(text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))){
+    return value;
+  }
+
+  try{
+    std::size_t used{0};
+    value = std::stoull(text, &used, 0);
+    if(used != text.size()){
+      value.reset();
+    }
+  }
+  catch(...){
+  }
+
+  if(value == 0){
+    value.reset();
+  }
+  return value;
+}
+
+int main(int argc, char *argv[]){
+  const std::filesystem::path thisExecutable(argv[0]);
+  const std::string usage = "Usage: " + thisExecutable.filename().string() + " [flags] trace\n"
+                            "Use --help flag for further information\n";
+  const std::string help = "Prints a trace written by the emulator's --trace flag, oldest instruction first\n"
+                           "Flags:\n"
+                           "-n [count]: Only print the last count instructions of each hart\n"
+                           "--symbols [path]: Debug map from the assembler's -m flag, names addresses\n";
+
+  std::vector<std::string> positionalArguments{};
+  std::optional<uint64_t> last{};
+  std::optional<std::filesystem::path> symbolsPath{};
+
+  for(int i{1}; i < argc; i++){
+    const std::string arg = argv[i];
+    const bool hasNext = i+1 < argc;
+
+    if(arg == "-n" || arg == "--symbols"){
+      if(!hasNext){
+        std::cerr << usage << arg << ": No value provided\n";
+        return EXIT_FAILURE;
+      }
+
+      const std::string text = argv[++i];
+
+      if(arg == "--symbols"){
+        symbolsPath = text;
+        continue;
+      }
+
+      last = parsePositive(text);
+      if(!last){
+        std::cerr << usage << "-n: Value must be a positive integer\n";
+        return EXIT_FAILURE;
+      }
+    }
+    else if(arg == "--help"){
+      std::cout << help;
+      return EXIT_SUCCESS;
+    }
+    else{
+      positionalArguments.push_back(argv[i]);
+    }
+  }
+
+  if(positionalArguments.size() < 1){
+    std::cerr << usage;
+    return EXIT_FAILURE;
+  }
+
+  DebugMap debug{};
+  if(symbolsPath && !debug.load(symbolsPath.value())){
+    std::cerr << "Failed to load debug map: " << symbolsPath.value().string() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::ifstream file(positionalArguments[0], std::ios::binary);
+  if(!file){
+    std::cerr << "Failed to open trace: " << positionalArguments[0] << "\n";
+    return EXIT_FAILURE;
+  }
+
+  TraceHeader header{};
+  while(file.read(reinterpret_cast<char *>(&header), sizeof(header))){
+    if(std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0){
+      std::cerr << "Not a trace or written on a host of different byte order\n";
+      return EXIT_FAILURE;
+    }
+
+    std::vector<TraceRecord> records(header.count);
+    if(!file.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(TraceRecord))){
+      std::cerr << "Trace is truncated\n";
+      return EXIT_FAILURE;
+    }
+
+    const uint64_t skip = last && last.value() < records.size() ? records.size() - last.value() : 0;
+
+    std::cout << "Hart " << std::dec << header.hart << ", from instruction " << header.first + skip << ":\n";
+    for(uint64_t i{skip}; i < records.size(); i++){
+      writeRecord(std::cout, records[i], debug);
+    }
+  }
+
+  return EXIT_SUCCESS;
+}